@@ -0,0 +1,168 @@
+// microbenchmarks of the paths that get slow with big label sets
+// usage: bench DIR [ITERATIONS]
+// DIR holds a .imgctool (see gen.c); each benchmark prints one line of JSON
+// to stdout with the minimum and median time of ITERATIONS (default 10) runs,
+// and how many operations (files, moves...) one run is
+// restore is only run once, since there's no way to unload a save
+// note that the save benchmarks rewrite DIR/.imgctool (with the same labels)
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/ictdata.h"
+struct ictFile* files = NULL;
+size_t nFiles = 0;
+struct ictCategory* categories = NULL;
+size_t nCategories = 0;
+
+#include "../src/saverestore.h"
+#include "../src/journal.h"
+#include "../src/layout.h"
+
+static const size_t NAV_MOVES = 1000000;
+static const size_t JOURNAL_EDITS = 256;
+static const int NARROW = 80, WIDE = 200;  // window widths for the layout
+
+static int iterations = 10;
+static uint64_t* times = NULL;
+
+static uint64_t rngState = 0x9e3779b97f4a7c15;
+static uint64_t rng() {
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545f4914f6cdd1d;
+}
+
+static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compareTimes(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// print the results of the n runs in times[]
+static void report(const char* name, int n, size_t ops) {
+    qsort(times, n, sizeof(uint64_t), compareTimes);
+    printf("{\"bench\":\"%s\",\"files\":%zu,\"chkboxes\":%zu,"
+        "\"iterations\":%d,\"ops\":%zu,\"min_ns\":%llu,\"median_ns\":%llu}\n",
+        name, nFiles, chkboxCount(), n, ops, (unsigned long long)times[0],
+        (unsigned long long)times[n / 2]);
+    fflush(stdout);
+}
+
+// what startup does for every argument when the same images are given again:
+// look each one up among the restored files
+static size_t benchLookup() {
+    size_t i, found = 0;
+    for (i = 0; i < nFiles; ++i) found += findFile(fileName(i)) != -1;
+    return found;
+}
+
+// random cursor movement, like holding down j/k/h/l
+static int benchNavigate() {
+    size_t i;
+    int idx = 0;
+    for (i = 0; i < NAV_MOVES; ++i) {
+        uint64_t r = rng();
+        int n = (int)(r >> 8) % 5 + 1;
+        if (r & 1) n = -n;
+        idx = r & 2 ? layoutMoveRows(idx, n) : layoutMoveCols(idx, n);
+    }
+    return idx;
+}
+
+// a burst of single-label edits followed by a save (which only appends them
+// to the journal); the same edits are made every time, so an even number of
+// runs leaves the labels as they were
+static int benchJournalSave() {
+    size_t i, bits = chkboxCount();
+    uint64_t saved = rngState;
+    rngState = 0x2545f4914f6cdd1d;
+    for (i = 0; i < JOURNAL_EDITS && bits > 0; ++i) {
+        size_t file = rng() % nFiles, bit = rng() % bits;
+        toggleLabel(file, bit);
+        journalLabel(file, bit, getLabel(file, bit));
+    }
+    rngState = saved;
+    return save();
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s DIR [ITERATIONS]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2) iterations = atoi(argv[2]);
+    if (iterations < 1) iterations = 1;
+    if (chdir(argv[1]) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    times = malloc(iterations * sizeof(uint64_t));
+
+    int i;
+    uint64_t t = now();
+    if (restore() != 0) return 1;
+    times[0] = now() - t;
+    report("restore", 1, nFiles);
+    if (nFiles == 0) {
+        fprintf(stderr, "no files in %s\n", argv[1]);
+        return 1;
+    }
+
+    for (i = 0; i < iterations; ++i) {
+        t = now();
+        benchLookup();
+        times[i] = now() - t;
+    }
+    report("lookup", iterations, nFiles);
+
+    for (i = 0; i < iterations; ++i) {
+        t = now();
+        layoutBuild(NARROW);
+        times[i] = now() - t;
+    }
+    report("layout_narrow", iterations, nCpos);
+
+    for (i = 0; i < iterations; ++i) {
+        t = now();
+        layoutBuild(WIDE);
+        times[i] = now() - t;
+    }
+    report("layout_wide", iterations, nCpos);
+
+    layoutBuild(NARROW);
+    for (i = 0; i < iterations; ++i) {
+        t = now();
+        benchNavigate();
+        times[i] = now() - t;
+    }
+    report("navigate", iterations, NAV_MOVES);
+
+    // (start from a fresh snapshot, so the journal saves don't compact)
+    journalInvalidate();
+    if (save() != 0) return 1;
+    for (i = 0; i < iterations; ++i) {
+        t = now();
+        if (benchJournalSave() != 0) return 1;
+        times[i] = now() - t;
+    }
+    report("save_journal", iterations, JOURNAL_EDITS);
+
+    for (i = 0; i < iterations; ++i) {
+        journalInvalidate();
+        t = now();
+        if (save() != 0) return 1;
+        times[i] = now() - t;
+    }
+    report("save_snapshot", iterations, nFiles);
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+// writes a synthetic .imgctool for the benchmarks (see bench.c)
+// usage: gen DIR FILES CHKBOXES [DENSITY]
+// DIR is created if necessary; the checkboxes are split into categories of 8,
+// the files into directories of 1000, and each checkbox is checked with
+// probability DENSITY (default 0.1), except that a fifth of the files are
+// left unlabeled
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../src/ictdata.h"
+struct ictFile* files = NULL;
+size_t nFiles = 0;
+struct ictCategory* categories = NULL;
+size_t nCategories = 0;
+
+#include "../src/saverestore.h"
+#include "../src/journal.h"
+
+static const size_t CATEGORY_SIZE = 8;
+static const size_t DIR_SIZE = 1000;
+
+// xorshift64*, so datasets are the same from run to run
+static uint64_t rngState = 0x9e3779b97f4a7c15;
+static uint64_t rng() {
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545f4914f6cdd1d;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s DIR FILES CHKBOXES [DENSITY]\n", argv[0]);
+        return 1;
+    }
+    size_t nWanted = strtoull(argv[2], NULL, 10),
+           nBits = strtoull(argv[3], NULL, 10);
+    double density = argc > 4 ? atof(argv[4]) : 0.1;
+
+    mkdir(argv[1], 0777);
+    if (chdir(argv[1]) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    char name[64];
+    size_t i, j;
+    struct ictCategory* cat = NULL;
+    for (i = 0; i < nBits; ++i) {
+        if (i % CATEGORY_SIZE == 0) {
+            snprintf(name, sizeof(name), "category%zu", i / CATEGORY_SIZE);
+            cat = pushCategory(name, strlen(name));
+        }
+        snprintf(name, sizeof(name), "checkbox%zu", i);
+        pushChkbox(cat, name, strlen(name));
+    }
+
+    for (i = 0; i < nWanted; ++i) {
+        snprintf(name, sizeof(name), "photos/%04zu/IMG_%08zu.jpg",
+            i / DIR_SIZE, i);
+        pushFile(name);
+    }
+    reserveLabelBits(nBits);
+
+    // (picking the checked bits directly is much faster than a coin flip for
+    // each of them)
+    size_t perFile = density * nBits + 0.5;
+    for (i = 0; i < nFiles && nBits > 0; ++i) {
+        if (rng() % 5 == 0) continue;
+        for (j = 0; j < perFile; ++j) setLabel(i, rng() % nBits, 1);
+    }
+
+    // (nothing's been saved yet, so this writes a snapshot)
+    journalInvalidate();
+    return save();
+}
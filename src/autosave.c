@@ -0,0 +1,110 @@
+#include "autosave.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "saverestore.h"
+#include "journal.h"
+
+static const long DEFAULT_INTERVAL = 5;
+static const long DEFAULT_EDITS = 256;
+
+static long interval = 0, maxEdits = 0;
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake;
+// all protected by lock
+static long edits = 0;
+static int requested = 0, quitting = 0, running = 0;
+
+static void* autosaveThread(void* arg) {
+    pthread_mutex_lock(&lock);
+    while (!quitting) {
+        if (!requested) {
+            if (interval == 0) {
+                while (!requested && !quitting) pthread_cond_wait(&wake, &lock);
+            } else {
+                struct timespec until;
+                clock_gettime(CLOCK_MONOTONIC, &until);
+                until.tv_sec += interval;
+                while (!requested && !quitting &&
+                        pthread_cond_timedwait(&wake, &lock, &until) !=
+                        ETIMEDOUT);
+            }
+            if (quitting) break;
+        }
+        requested = 0;
+        edits = 0;
+        pthread_mutex_unlock(&lock);
+
+        // (save() only holds the state lock long enough to copy the labels,
+        // so the interface doesn't notice this; journalDirty() looks at the
+        // categories too, so it needs the lock as well)
+        lockState();
+        int dirty = journalDirty();
+        unlockState();
+        if (dirty) save();
+
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static long envLong(const char* name, long def) {
+    char* val = getenv(name);
+    if (val == NULL || *val == '\0') return def;
+    return strtol(val, NULL, 10);
+}
+
+void autosaveInit() {
+    interval = envLong("IMG_AUTOSAVE", DEFAULT_INTERVAL);
+    maxEdits = envLong("IMG_AUTOSAVE_EDITS", DEFAULT_EDITS);
+    if (interval < 0) interval = 0;
+
+    // timeouts are measured on the monotonic clock, so changing the time
+    // doesn't hold up (or hurry) a save
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&thread, NULL, autosaveThread, NULL) == 0) running = 1;
+}
+
+void autosaveEdited() {
+    if (!running) return;
+    pthread_mutex_lock(&lock);
+    if (maxEdits > 0 && ++edits >= maxEdits) {
+        requested = 1;
+        pthread_cond_signal(&wake);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int autosaveNow() {
+    // (without the thread, e.g. after autosaveQuit() failed to save, the
+    // caller waits for the save itself)
+    if (!running) return save();
+    pthread_mutex_lock(&lock);
+    requested = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int autosaveQuit() {
+    if (running) {
+        pthread_mutex_lock(&lock);
+        quitting = 1;
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+        pthread_join(thread, NULL);
+        running = 0;
+    }
+    return save();
+}
@@ -0,0 +1,19 @@
+#ifndef __AUTOSAVE_H__
+#define __AUTOSAVE_H__
+
+// start the autosave thread, which calls save() whenever there are unsaved
+// changes, every IMG_AUTOSAVE seconds (default 5, 0 to only save when asked)
+// or sooner once IMG_AUTOSAVE_EDITS edits (default 256) have piled up
+void autosaveInit();
+
+// something was just edited
+void autosaveEdited();
+
+// save as soon as possible, without waiting for it if the autosave thread is
+// running (otherwise returns save()'s result); call without the state lock
+int autosaveNow();
+
+// stop the autosave thread and save whatever's left; returns save()'s result
+int autosaveQuit();
+
+#endif
@@ -0,0 +1,188 @@
+#include "bulk.h"
+
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ictdata.h"
+#include "journal.h"
+#include "stats.h"
+#include "dedupe.h"
+
+static size_t selectionWords() {
+    return (nFiles + 63) / 64;
+}
+
+uint64_t* bulkSelectRange(size_t from, size_t to) {
+    uint64_t* selected = calloc(selectionWords() + 1, sizeof(uint64_t));
+    if (nFiles == 0) return selected;
+    if (from > to) {
+        size_t tmp = from;
+        from = to;
+        to = tmp;
+    }
+    if (to >= nFiles) to = nFiles - 1;
+    if (from > to) return selected;
+
+    // whole words in the middle, partial ones at either end
+    size_t first = from >> 6, last = to >> 6, w;
+    for (w = first; w <= last; ++w) selected[w] = ~(uint64_t)0;
+    selected[first] &= ~(uint64_t)0 << (from & 63);
+    selected[last] &= ~(uint64_t)0 >> (63 - (to & 63));
+    return selected;
+}
+
+// translate a glob into an (anchored) extended regex
+static char* globToRegex(const char* glob) {
+    const char* ERE_SPECIAL = ".+(){}|^$\\";
+    // at worst every character becomes two, plus the anchors
+    char* re = malloc(2 * strlen(glob) + 8);
+    char* out = re;
+    const char* p;
+
+    *out++ = '^';
+    for (p = glob; *p; ++p) {
+        if (*p == '*' && p[1] == '*') {
+            out = stpcpy(out, ".*");
+            ++p;
+        } else if (*p == '*') {
+            out = stpcpy(out, "[^/]*");
+        } else if (*p == '?') {
+            out = stpcpy(out, "[^/]");
+        } else if (*p == '[') {
+            // copy a set through as-is (they mean the same thing), except
+            // for the glob-style negation
+            const char* end = p + 1;
+            if (*end == '!' || *end == '^') ++end;
+            if (*end == ']') ++end;
+            end = strchr(end, ']');
+            if (end == NULL) {
+                // not a set after all
+                out = stpcpy(out, "\\[");
+                continue;
+            }
+            *out++ = '[';
+            ++p;
+            if (*p == '!') {
+                *out++ = '^';
+                ++p;
+            }
+            memcpy(out, p, end - p + 1);
+            out += end - p + 1;
+            p = end;
+        } else if (*p == '\\' && p[1] != '\0') {
+            ++p;
+            if (strchr(ERE_SPECIAL, *p) || *p == '*' || *p == '?' ||
+                    *p == '[') {
+                *out++ = '\\';
+            }
+            *out++ = *p;
+        } else {
+            if (strchr(ERE_SPECIAL, *p)) *out++ = '\\';
+            *out++ = *p;
+        }
+    }
+    *out++ = '$';
+    *out = '\0';
+    return re;
+}
+
+// whether a glob (translated by globToRegex()) matches the whole path or a
+// part of it after some slash
+// (trying each of those separately with an anchored regex is a lot faster
+// than one regex starting with (^|/), which glibc tries at every offset)
+static int globMatches(const regex_t* compiled, const char* path) {
+    const char* p = path;
+    while (1) {
+        if (regexec(compiled, p, 0, NULL, 0) == 0) return 1;
+        p = strchr(p, '/');
+        if (p == NULL) return 0;
+        ++p;
+    }
+}
+
+uint64_t* bulkSelectMatch(const char* pattern) {
+    size_t len = strlen(pattern);
+    int isRegex = len >= 2 && pattern[0] == '/' && pattern[len - 1] == '/';
+    char* re = isRegex ? strndup(pattern + 1, len - 2) : globToRegex(pattern);
+    // a glob that can't match a slash can only match the basename
+    int baseOnly = !isRegex && strchr(pattern, '/') == NULL &&
+        strstr(pattern, "**") == NULL;
+
+    regex_t compiled;
+    int err = regcomp(&compiled, re, REG_EXTENDED | REG_NOSUB);
+    free(re);
+    if (err != 0) return NULL;
+
+    uint64_t* selected = calloc(selectionWords() + 1, sizeof(uint64_t));
+    size_t i;
+    for (i = 0; i < nFiles; ++i) {
+        int match;
+        if (baseOnly) {
+            match = regexec(&compiled, fileBaseName(i), 0, NULL, 0) == 0;
+        } else if (isRegex) {
+            match = regexec(&compiled, fileName(i), 0, NULL, 0) == 0;
+        } else {
+            match = globMatches(&compiled, fileName(i));
+        }
+        if (match) {
+            selected[i >> 6] |= (uint64_t)1 << (i & 63);
+        }
+    }
+    regfree(&compiled);
+    return selected;
+}
+
+size_t bulkCount(const uint64_t* selected) {
+    size_t w, n = 0;
+    for (w = 0; w < selectionWords(); ++w) {
+        n += __builtin_popcountll(selected[w]);
+    }
+
+    return n;
+}
+
+// replace selected copies of files (see dedupe.h) with the first file of
+// their group, so each group is only changed once
+static uint64_t* selectFirstCopies(const uint64_t* selected) {
+    uint64_t* firsts = malloc((selectionWords() + 1) * sizeof(uint64_t));
+    memcpy(firsts, selected, selectionWords() * sizeof(uint64_t));
+    size_t w;
+    for (w = 0; w < selectionWords(); ++w) {
+        uint64_t s = selected[w];
+        while (s != 0) {
+            size_t file = (w << 6) | __builtin_ctzll(s), f = dupFirst(file);
+            s &= s - 1;
+            if (f == file) continue;
+            firsts[w] &= ~((uint64_t)1 << (file & 63));
+            firsts[f >> 6] |= (uint64_t)1 << (f & 63);
+        }
+    }
+    return firsts;
+}
+
+size_t bulkApply(const uint64_t* selection, size_t bit, enum bulkOp op) {
+    uint64_t* selected = selectFirstCopies(selection);
+    uint64_t* col = labelColumns[bit];
+    size_t w, changed = 0;
+    for (w = 0; w < selectionWords(); ++w) {
+        // a whole word of files at once, then visit just the ones that changed
+        uint64_t old = col[w], s = selected[w];
+        if (op == BULK_SET) col[w] |= s;
+        else if (op == BULK_CLEAR) col[w] &= ~s;
+        else col[w] ^= s;
+        uint64_t diff = col[w] ^ old;
+        while (diff != 0) {
+            size_t file = (w << 6) | __builtin_ctzll(diff);
+            diff &= diff - 1;
+            int value = getLabel(file, bit);
+            journalLabel(file, bit, value);
+            statsLabelChanged(file, bit, value);
+            dedupePropagate(file, bit);
+            ++changed;
+        }
+    }
+
+    free(selected);
+    return changed;
+}
@@ -0,0 +1,33 @@
+#ifndef __BULK_H__
+#define __BULK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// labeling many files at once
+// a selection of files is a bitset with one bit per file (file i is bit
+// i % 64 of word i / 64), allocated by one of the bulkSelect functions and
+// freed with free()
+
+enum bulkOp { BULK_SET, BULK_CLEAR, BULK_TOGGLE };
+
+// files from..to (inclusive; either order)
+uint64_t* bulkSelectRange(size_t from, size_t to);
+
+// files whose path matches pattern: a regex (POSIX extended) if it's wrapped
+// in slashes, like /frame_0+[0-9]{3}\.png$/, otherwise a glob, where * and ?
+// don't match a slash but ** does
+// a glob has to match the whole path or a trailing part of it starting after
+// a slash, so *.png matches every PNG and cam3/*.png the ones in any cam3
+// returns NULL if the pattern doesn't compile
+uint64_t* bulkSelectMatch(const char* pattern);
+
+// number of files in a selection
+size_t bulkCount(const uint64_t* selected);
+
+// apply op to checkbox `bit' of every selected file and its copies (recording
+// the edits in the journal and the counts in stats.h), return how many
+// selected files (not counting copies) actually changed
+size_t bulkApply(const uint64_t* selected, size_t bit, enum bulkOp op);
+
+#endif
@@ -0,0 +1,251 @@
+#include "dedupe.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ictdata.h"
+#include "journal.h"
+#include "stats.h"
+
+struct fileStamp* fileStamps = NULL;
+size_t nFileStamps = 0;
+
+// groups of copies are circular lists through next[]; NULL if there are none
+static size_t *first = NULL, *next = NULL;
+
+// XXH64 (https://github.com/Cyan4973/xxHash), seed 0
+
+static const uint64_t P1 = 11400714785074694791ULL,
+    P2 = 14029467366897019727ULL, P3 = 1609587929392839161ULL,
+    P4 = 9650029242287828579ULL, P5 = 2870177450012600261ULL;
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// (XXH64 reads its input as little endian words, whatever the host)
+static uint64_t getLE(const unsigned char* p, int bytes) {
+    uint64_t x = 0;
+    int i;
+    for (i = bytes - 1; i >= 0; --i) x = (x << 8) | p[i];
+    return x;
+}
+
+static uint64_t xxhRound(uint64_t acc, uint64_t input) {
+    return rotl(acc + input * P2, 31) * P1;
+}
+
+static uint64_t xxhMerge(uint64_t acc, uint64_t v) {
+    return (acc ^ xxhRound(0, v)) * P1 + P4;
+}
+
+static uint64_t xxh64(const unsigned char* p, size_t len) {
+    const unsigned char* end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = P1 + P2, v2 = P2, v3 = 0, v4 = -P1;
+        for (; end - p >= 32; p += 32) {
+            v1 = xxhRound(v1, getLE(p, 8));
+            v2 = xxhRound(v2, getLE(p + 8, 8));
+            v3 = xxhRound(v3, getLE(p + 16, 8));
+            v4 = xxhRound(v4, getLE(p + 24, 8));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = xxhMerge(xxhMerge(xxhMerge(xxhMerge(h, v1), v2), v3), v4);
+    } else {
+        h = P5;
+    }
+    h += len;
+    for (; end - p >= 8; p += 8) {
+        h = rotl(h ^ xxhRound(0, getLE(p, 8)), 27) * P1 + P4;
+    }
+    if (end - p >= 4) {
+        h = rotl(h ^ (getLE(p, 4) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p) h = rotl(h ^ (*p * P5), 11) * P1;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// hash one file, if its stamp is out of date; returns -1 if it can't be
+// read (and leaves it unhashed), 1 if it was hashed and 0 if the stamp was
+// fine
+static int stampFile(size_t file) {
+    struct fileStamp* s = &fileStamps[file];
+    int fd = open(fileName(file), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        if (fd != -1) close(fd);
+        s->size = UINT64_MAX;
+        return -1;
+    }
+    if (s->size == (uint64_t)st.st_size &&
+            s->mtimeSec == (uint64_t)st.st_mtim.tv_sec &&
+            s->mtimeNsec == (uint64_t)st.st_mtim.tv_nsec) {
+        close(fd);
+        return 0;
+    }
+
+    uint64_t hash = xxh64(NULL, 0);
+    if (st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            s->size = UINT64_MAX;
+            return -1;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        hash = xxh64(map, st.st_size);
+        munmap(map, st.st_size);
+    }
+    close(fd);
+
+    s->size = st.st_size;
+    s->mtimeSec = st.st_mtim.tv_sec;
+    s->mtimeNsec = st.st_mtim.tv_nsec;
+    s->hash = hash;
+    return 1;
+}
+
+// the hashing threads take files in chunks of this many
+static const size_t CHUNK = 64;
+static size_t nextChunk = 0;  // (atomic)
+static size_t nHashed = 0, nUnreadable = 0;  // (atomic)
+
+static void* worker(void* arg) {
+    size_t start, i;
+    while ((start = __atomic_fetch_add(&nextChunk, CHUNK, __ATOMIC_RELAXED))
+            < nFiles) {
+        size_t hashed = 0, unreadable = 0;
+        for (i = start; i < start + CHUNK && i < nFiles; ++i) {
+            int r = stampFile(i);
+            if (r == 1) ++hashed;
+            if (r == -1) {
+                fprintf(stderr, "%s: can't read file\n", fileName(i));
+                ++unreadable;
+            }
+        }
+        __atomic_fetch_add(&nHashed, hashed, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&nUnreadable, unreadable, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static int compareStamps(const void* a, const void* b) {
+    const struct fileStamp *x = &fileStamps[*(const size_t*)a],
+        *y = &fileStamps[*(const size_t*)b];
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    if (x->size != y->size) return x->size < y->size ? -1 : 1;
+    // (so each group comes out in files[] order)
+    return *(const size_t*)a < *(const size_t*)b ? -1 : 1;
+}
+
+void dedupeFiles() {
+    size_t i, j, w;
+
+    // files added since the last save haven't been hashed
+    fileStamps = realloc(fileStamps, (nFiles + 1) * sizeof(struct fileStamp));
+    for (i = nFileStamps; i < nFiles; ++i) fileStamps[i].size = UINT64_MAX;
+    nFileStamps = nFiles;
+
+    char* threadsEnv = getenv("IMG_THREADS");
+    long nThreads = threadsEnv != NULL ? atol(threadsEnv) :
+        sysconf(_SC_NPROCESSORS_ONLN);
+    if (nThreads < 1) nThreads = 1;
+    pthread_t* threads = malloc(nThreads * sizeof(pthread_t));
+    for (i = 0; i < nThreads; ++i) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    for (i = 0; i < nThreads; ++i) pthread_join(threads[i], NULL);
+    free(threads);
+    // the new hashes need to be saved (and hashes of files that can't be read
+    // anymore dropped)
+    if (nHashed || nUnreadable) journalInvalidate();
+
+    // sort by content, so copies end up next to each other
+    size_t* order = malloc((nFiles + 1) * sizeof(size_t));
+    for (i = 0; i < nFiles; ++i) order[i] = i;
+    qsort(order, nFiles, sizeof(size_t), compareStamps);
+
+    first = realloc(first, (nFiles + 1) * sizeof(size_t));
+    next = realloc(next, (nFiles + 1) * sizeof(size_t));
+    size_t nGroups = 0, nCopies = 0, nMerged = 0;
+    for (i = 0; i < nFiles; i = j) {
+        const struct fileStamp* s = &fileStamps[order[i]];
+        // (unhashed files aren't copies of anything)
+        for (j = i + 1; j < nFiles && s->size != UINT64_MAX &&
+                fileStamps[order[j]].hash == s->hash &&
+                fileStamps[order[j]].size == s->size; ++j) {
+            next[order[j - 1]] = order[j];
+        }
+        next[order[j - 1]] = order[i];
+
+        size_t k, lead = order[i];
+        for (k = i; k < j; ++k) first[order[k]] = lead;
+        if (j - i == 1) continue;
+        ++nGroups;
+        nCopies += j - i - 1;
+    }
+    free(order);
+
+    // every copy gets every label any of them had: go through the checked
+    // labels, and check them on all the other copies too
+    uint64_t* merged = calloc((nFiles + 63) / 64 + 1, sizeof(uint64_t));
+    size_t bit, nBits = chkboxCount();
+    for (bit = 0; bit < nBits && nCopies; ++bit) {
+        const uint64_t* col = labelColumns[bit];
+        for (w = 0; w < (nFiles + 63) / 64; ++w) {
+            uint64_t x;
+            for (x = col[w]; x != 0; x &= x - 1) {
+                size_t file = (w << 6) | __builtin_ctzll(x), copy,
+                       lead = first[file];
+                for (copy = next[file]; copy != file; copy = next[copy]) {
+                    if (getLabel(copy, bit)) continue;
+                    setLabel(copy, bit, 1);
+                    // (each group that changes counts once)
+                    uint64_t mask = (uint64_t)1 << (lead & 63);
+                    if (!(merged[lead >> 6] & mask)) ++nMerged;
+                    merged[lead >> 6] |= mask;
+                }
+            }
+        }
+    }
+    free(merged);
+
+    if (nMerged) journalInvalidate();
+
+    printf("Hashed %zu of %zu files", nHashed, nFiles);
+    if (nUnreadable) printf(" (%zu unreadable)", nUnreadable);
+    printf("; found %zu copies of %zu files", nCopies, nGroups);
+    if (nMerged) printf(" (merged the labels of %zu of those)", nMerged);
+    printf(".\n");
+}
+
+size_t dupFirst(size_t file) {
+    return first == NULL ? file : first[file];
+}
+
+size_t dupNext(size_t file) {
+    return next == NULL ? file : next[file];
+}
+
+void dedupePropagate(size_t file, size_t bit) {
+    int value = getLabel(file, bit);
+    size_t copy;
+    for (copy = dupNext(file); copy != file; copy = dupNext(copy)) {
+        if (getLabel(copy, bit) == value) continue;
+        setLabel(copy, bit, value);
+        journalLabel(copy, bit, value);
+        statsLabelChanged(copy, bit, value);
+    }
+}
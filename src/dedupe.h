@@ -0,0 +1,36 @@
+#ifndef __DEDUPE_H__
+#define __DEDUPE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// finding byte-identical files, so they can be labeled as one
+
+// what we know about each file's content: its XXH64 hash, and the size and
+// mtime it had when it was hashed (cached in the save file, see
+// saverestore.c); size is UINT64_MAX if the file hasn't been hashed
+extern struct fileStamp {
+    uint64_t size;
+    uint64_t mtimeSec;
+    uint64_t mtimeNsec;
+    uint64_t hash;
+}* fileStamps;
+extern size_t nFileStamps;  // files added since the last save have none yet
+
+// hash every file whose size or mtime changed since it was last hashed
+// (spread over IMG_THREADS threads), then group identical files: their labels
+// are merged, and from then on labeling one labels all of them (files that
+// can't be read are left unhashed, so they have no copies)
+void dedupeFiles();
+
+// the first file (in files[] order) with the same content as `file', and the
+// next one after `file' (wrapping around to the first); both are `file'
+// itself if it has no copies, or dedupeFiles() wasn't called
+size_t dupFirst(size_t file);
+size_t dupNext(size_t file);
+
+// give all copies of `file' the same value for checkbox `bit' as it has
+// (recording the edits in the journal and stats.h)
+void dedupePropagate(size_t file, size_t bit);
+
+#endif
@@ -1,5 +1,7 @@
+#define _GNU_SOURCE  // memrchr()
 #include "ictdata.h"
 
+#include <stdint.h>
 #include <string.h>
 
 int addCh(char** s, char ch, int bufLen) {
@@ -13,3 +15,356 @@ int addCh(char** s, char ch, int bufLen) {
     (*s)[len] = ch;
     return bufLen;
 }
+
+// files[] grows geometrically; this is how much room it actually has
+// (every label column has room for the same number of files)
+static size_t filesCap = 0;
+
+uint64_t** labelColumns = NULL;
+static size_t nColumns = 0, columnsCap = 0;
+
+size_t chkboxCount() {
+    size_t i, count = 0;
+    for (i = 0; i < nCategories; ++i) count += categories[i].nChkboxes;
+    return count;
+}
+
+size_t categoryFirstBit(size_t categoryIdx) {
+    size_t i, bit = 0;
+    for (i = 0; i < categoryIdx; ++i) bit += categories[i].nChkboxes;
+    return bit;
+}
+
+size_t labelWords() {
+    return (filesCap + 63) >> 6;
+}
+
+// files[] now has room for `cap' files; make every column big enough too
+static void resizeLabels(size_t cap) {
+    size_t oldWords = labelWords(), words = (cap + 63) >> 6, i;
+    filesCap = cap;
+    if (words <= oldWords) return;
+    for (i = 0; i < nColumns; ++i) {
+        labelColumns[i] = realloc(labelColumns[i],
+            (words ? words : 1) * sizeof(uint64_t));
+        memset(labelColumns[i] + oldWords, 0,
+            (words - oldWords) * sizeof(uint64_t));
+    }
+}
+
+static uint64_t* newColumn() {
+    size_t words = labelWords();
+    return calloc(words ? words : 1, sizeof(uint64_t));
+}
+
+static void reserveColumns(size_t n) {
+    if (n <= columnsCap) return;
+    while (columnsCap < n) columnsCap = columnsCap ? columnsCap * 2 : 16;
+    labelColumns = realloc(labelColumns, columnsCap * sizeof(uint64_t*));
+}
+
+void reserveLabelBits(size_t nBits) {
+    reserveColumns(nBits);
+    for (; nColumns < nBits; ++nColumns) labelColumns[nColumns] = newColumn();
+}
+
+void insertLabelColumn(size_t bit) {
+    reserveLabelBits(bit);
+    reserveColumns(nColumns + 1);
+    memmove(labelColumns + bit + 1, labelColumns + bit,
+        (nColumns - bit) * sizeof(uint64_t*));
+    labelColumns[bit] = newColumn();
+    ++nColumns;
+}
+
+void deleteLabelColumn(size_t bit) {
+    if (bit >= nColumns) return;
+    free(labelColumns[bit]);
+    memmove(labelColumns + bit, labelColumns + bit + 1,
+        (nColumns - bit - 1) * sizeof(uint64_t*));
+    --nColumns;
+}
+
+// string arena: strings are bump-allocated out of big chunks and never freed
+// individually, which saves both a malloc() and its overhead per name
+static const size_t ARENA_CHUNK = 1 << 20;
+static char *arenaPos = NULL, *arenaEnd = NULL;
+
+char* arenaStrndup(const char* s, size_t len) {
+    if (arenaPos == NULL || (size_t)(arenaEnd - arenaPos) < len + 1) {
+        // anything that wouldn't leave most of a chunk free gets its own
+        size_t size = len + 1 > ARENA_CHUNK / 4 ? len + 1 : ARENA_CHUNK;
+        char* chunk = malloc(size);
+        if (size != ARENA_CHUNK) {
+            memcpy(chunk, s, len);
+            chunk[len] = '\0';
+            return chunk;
+        }
+        arenaPos = chunk;
+        arenaEnd = chunk + size;
+    }
+    char* copy = arenaPos;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    arenaPos += len + 1;
+    return copy;
+}
+
+char* arenaStrdup(const char* s) {
+    return arenaStrndup(s, strlen(s));
+}
+
+// arrays here grow by doubling whenever their length reaches a power of 2;
+// nothing ever shrinks them, so the capacity is always at least that
+static void* growArray(void* array, size_t n, size_t size) {
+    if (n == 0) return realloc(array, size);
+    if ((n & (n - 1)) == 0) return realloc(array, 2 * n * size);
+    return array;
+}
+
+struct ictCategory* pushCategory(const char* name, size_t len) {
+    categories = growArray(categories, nCategories,
+        sizeof(struct ictCategory));
+    struct ictCategory* cat = &categories[nCategories++];
+    cat->name = arenaStrndup(name, len);
+    cat->chkboxes = NULL;
+    cat->nChkboxes = 0;
+    return cat;
+}
+
+void pushChkbox(struct ictCategory* cat, const char* name, size_t len) {
+    cat->chkboxes = growArray(cat->chkboxes, cat->nChkboxes, sizeof(char*));
+    cat->chkboxes[cat->nChkboxes++] = arenaStrndup(name, len);
+}
+
+// open addressing (linear probing) hash index into an array
+// a slot with idx 0 is empty, otherwise it refers to element idx - 1
+struct hashIndex {
+    struct hashSlot {
+        uint32_t hash;
+        uint32_t idx;
+    }* slots;
+    size_t cap;  // always 0 or a power of 2
+};
+
+static uint32_t hashBytes(uint32_t h, const char* s, size_t len) {
+    // FNV-1a (pass 2166136261 to start a new hash, or a previous result to
+    // continue it)
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void indexInsert(struct hashIndex* index, uint32_t hash, size_t idx) {
+    size_t mask = index->cap - 1, i = hash & mask;
+    while (index->slots[i].idx != 0) i = (i + 1) & mask;
+    index->slots[i].hash = hash;
+    index->slots[i].idx = idx + 1;
+}
+
+// make room for element n (keeping the load factor at or below 1/2)
+static void indexReserve(struct hashIndex* index, size_t n) {
+    if ((n + 1) * 2 <= index->cap) return;
+
+    struct hashSlot* old = index->slots;
+    size_t oldCap = index->cap, i;
+    index->cap = oldCap ? oldCap * 2 : 1024;
+    index->slots = calloc(index->cap, sizeof(struct hashSlot));
+    for (i = 0; i < oldCap; ++i) {
+        if (old[i].idx != 0) indexInsert(index, old[i].hash, old[i].idx - 1);
+    }
+    free(old);
+}
+
+// filenames are split into an interned directory (everything up to and
+// including the last '/') and a basename, since most files in a dataset share
+// a handful of directories; dirs[0] is the empty directory
+static char** dirs = NULL;
+static size_t nDirs = 0;
+static struct hashIndex dirIndex, fileIndex;
+
+// files [0, nLazy) aren't loaded (see pushLazyFiles()) as long as this is set
+static const char* (*lazyName)(size_t file, size_t* len) = NULL;
+static size_t nLazy = 0;
+static void loadLazyFiles();
+
+static ssize_t findDir(const char* dir, size_t len, uint32_t hash) {
+    size_t mask = dirIndex.cap - 1, i;
+    if (dirIndex.cap == 0) return -1;
+    for (i = hash & mask; dirIndex.slots[i].idx != 0; i = (i + 1) & mask) {
+        const char* d = dirs[dirIndex.slots[i].idx - 1];
+        if (dirIndex.slots[i].hash == hash && strncmp(d, dir, len) == 0 &&
+                d[len] == '\0') {
+            return dirIndex.slots[i].idx - 1;
+        }
+    }
+    return -1;
+}
+
+static size_t internDir(const char* dir, size_t len) {
+    uint32_t hash = hashBytes(2166136261u, dir, len);
+    ssize_t idx = findDir(dir, len, hash);
+    if (idx != -1) return idx;
+
+    dirs = growArray(dirs, nDirs, sizeof(char*));
+    dirs[nDirs] = arenaStrndup(dir, len);
+    indexReserve(&dirIndex, nDirs);
+    indexInsert(&dirIndex, hash, nDirs);
+    return nDirs++;
+}
+
+static size_t dirLen(const char* filename, size_t len) {
+    const char* slash = memrchr(filename, '/', len);
+    return slash == NULL ? 0 : slash - filename + 1;
+}
+
+const char* fileName(size_t file) {
+    // (each thread gets its own buffer)
+    static _Thread_local char* buf = NULL;
+    static _Thread_local size_t bufLen = 0;
+
+    if (lazyName != NULL && file < nLazy) {
+        size_t len;
+        const char* name = lazyName(file, &len);
+        if (len + 1 > bufLen) {
+            bufLen = (len + 1) * 2;
+            buf = realloc(buf, bufLen);
+        }
+        memcpy(buf, name, len);
+        buf[len] = '\0';
+        return buf;
+    }
+
+    const char* dir = dirs[files[file].dir];
+    if (*dir == '\0') return files[file].base;
+
+    size_t dLen = strlen(dir), bLen = strlen(files[file].base);
+    if (dLen + bLen + 1 > bufLen) {
+        bufLen = (dLen + bLen + 1) * 2;
+        buf = realloc(buf, bufLen);
+    }
+    memcpy(buf, dir, dLen);
+    memcpy(buf + dLen, files[file].base, bLen + 1);
+    return buf;
+}
+
+const char* fileBaseName(size_t file) {
+    if (lazyName != NULL && file < nLazy) {
+        const char* name = fileName(file);
+        const char* slash = strrchr(name, '/');
+        return slash == NULL ? name : slash + 1;
+    }
+    return files[file].base;
+}
+
+const char* fileDir(size_t file) {
+    if (lazyName != NULL) loadLazyFiles();
+    return dirs[files[file].dir];
+}
+
+// fill in files[file] and index it
+static void setFile(size_t file, const char* filename, size_t len) {
+    size_t dLen = dirLen(filename, len);
+    files[file].dir = internDir(filename, dLen);
+    files[file].base = arenaStrndup(filename + dLen, len - dLen);
+
+    indexReserve(&fileIndex, file);
+    indexInsert(&fileIndex, hashBytes(2166136261u, filename, len), file);
+}
+
+size_t pushFileN(const char* filename, size_t len) {
+    if (lazyName != NULL) loadLazyFiles();
+    if (nDirs == 0) internDir("", 0);
+    if (nFiles == filesCap) {
+        size_t cap = filesCap ? filesCap * 2 : 64;
+        files = realloc(files, cap * sizeof(struct ictFile));
+        resizeLabels(cap);
+    }
+    setFile(nFiles, filename, len);
+    return nFiles++;
+}
+
+void pushLazyFiles(size_t n, const char* (*name)(size_t file, size_t* len)) {
+    if (n == 0) return;
+    // (files[] is left uninitialized, so untouched parts of it cost nothing)
+    files = realloc(files, n * sizeof(struct ictFile));
+    resizeLabels(n);
+    nFiles = nLazy = n;
+    lazyName = name;
+}
+
+static void loadLazyFiles() {
+    size_t i, len;
+    if (nDirs == 0) internDir("", 0);
+    indexReserve(&fileIndex, nLazy);
+    for (i = 0; i < nLazy; ++i) {
+        const char* name = lazyName(i, &len);
+        setFile(i, name, len);
+    }
+    lazyName = NULL;
+}
+
+size_t pushFile(const char* filename) {
+    return pushFileN(filename, strlen(filename));
+}
+
+ssize_t findFile(const char* filename) {
+    size_t len = strlen(filename), dLen = dirLen(filename, len), mask, i;
+    ssize_t dir;
+    if (lazyName != NULL) loadLazyFiles();
+    if (fileIndex.cap == 0) return -1;
+
+    if ((dir = findDir(filename, dLen, hashBytes(2166136261u, filename, dLen)))
+            == -1) {
+        return -1;  // can't be there if its directory isn't
+    }
+
+    uint32_t hash = hashBytes(2166136261u, filename, len);
+    mask = fileIndex.cap - 1;
+    for (i = hash & mask; fileIndex.slots[i].idx != 0; i = (i + 1) & mask) {
+        struct ictFile* file = &files[fileIndex.slots[i].idx - 1];
+        if (fileIndex.slots[i].hash == hash && file->dir == dir &&
+                strcmp(file->base, filename + dLen) == 0) {
+            return fileIndex.slots[i].idx - 1;
+        }
+    }
+    return -1;
+}
+
+void permuteFiles(const size_t* order) {
+    size_t i, w, bit, words = (nFiles + 63) >> 6;
+    if (lazyName != NULL) loadLazyFiles();
+
+    // where each file goes
+    size_t* dest = malloc((nFiles + 1) * sizeof(size_t));
+    for (i = 0; i < nFiles; ++i) dest[order[i]] = i;
+
+    struct ictFile* moved = malloc((filesCap + 1) * sizeof(struct ictFile));
+    for (i = 0; i < nFiles; ++i) moved[i] = files[order[i]];
+    free(files);
+    files = moved;
+
+    // (most columns are sparse, so scatter their set bits)
+    for (bit = 0; bit < nColumns; ++bit) {
+        uint64_t* col = newColumn();
+        for (w = 0; w < words; ++w) {
+            uint64_t x;
+            for (x = labelColumns[bit][w]; x != 0; x &= x - 1) {
+                size_t to = dest[(w << 6) | __builtin_ctzll(x)];
+                col[to >> 6] |= (uint64_t)1 << (to & 63);
+            }
+        }
+        free(labelColumns[bit]);
+        labelColumns[bit] = col;
+    }
+
+    for (i = 0; i < fileIndex.cap; ++i) {
+        if (fileIndex.slots[i].idx != 0) {
+            fileIndex.slots[i].idx = dest[fileIndex.slots[i].idx - 1] + 1;
+        }
+    }
+    free(dest);
+}
@@ -1,7 +1,9 @@
 #ifndef __ICTDATA_H__
 #define __ICTDATA_H__
 
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 // used for C-string buffers
 static const int BUF_ADD_SIZE = 10;
@@ -10,8 +12,8 @@ static const int BUF_ADD_SIZE = 10;
 int addCh(char** s, char ch, int bufLen);
 
 extern struct ictFile {
-    char* filename;
-    long long data;
+    uint32_t dir;      // interned directory, see fileName()
+    const char* base;  // everything after the directory
 }* files;
 extern size_t nFiles;
 
@@ -22,4 +24,82 @@ extern struct ictCategory {
 }* categories;
 extern size_t nCategories;
 
+// checkbox data is stored a column per checkbox: labelColumns[n] is a bitmap
+// of the files that have checkbox n (counting across all categories, in
+// order) checked, file i being bit i % 64 of word i / 64, and every column
+// has labelWords() words
+// a column belongs to its checkbox rather than to a position, so adding or
+// deleting a checkbox just moves pointers around (see insertLabelColumn())
+extern uint64_t** labelColumns;
+
+static inline int getLabel(size_t file, size_t bit) {
+    return (labelColumns[bit][file >> 6] >> (file & 63)) & 1;
+}
+static inline void setLabel(size_t file, size_t bit, int value) {
+    uint64_t mask = (uint64_t)1 << (file & 63);
+    if (value) labelColumns[bit][file >> 6] |= mask;
+    else labelColumns[bit][file >> 6] &= ~mask;
+}
+static inline void toggleLabel(size_t file, size_t bit) {
+    labelColumns[bit][file >> 6] ^= (uint64_t)1 << (file & 63);
+}
+
+// total number of checkboxes, across all categories
+size_t chkboxCount();
+
+// index (counting across all categories) of the first checkbox of a category
+size_t categoryFirstBit(size_t categoryIdx);
+
+// number of words in each label column (enough for every file, and then some)
+size_t labelWords();
+
+// add empty columns (if necessary) so there's one for each of nBits bits
+void reserveLabelBits(size_t nBits);
+
+// add an empty column for a new checkbox at `bit' (counting across all
+// categories), moving the columns of those after it up one
+void insertLabelColumn(size_t bit);
+
+// drop the column of the checkbox at `bit', moving those after it down one
+void deleteLabelColumn(size_t bit);
+
+// copy a string into the string arena (see ictdata.c); the copy lives for
+// the rest of the program
+char* arenaStrdup(const char* s);
+char* arenaStrndup(const char* s, size_t len);
+
+// append a category/checkbox, copying its name into the string arena
+struct ictCategory* pushCategory(const char* name, size_t len);
+void pushChkbox(struct ictCategory* cat, const char* name, size_t len);
+
+// full path of a file; the result is only valid until the next call to
+// fileName() from the same thread
+const char* fileName(size_t file);
+
+// just the part of it after the last '/' (valid for as long)
+const char* fileBaseName(size_t file);
+
+// the part up to and including the last '/' ("" if there isn't one); these
+// are interned, so files in the same directory get the same pointer
+// (this loads any lazily added names, see pushLazyFiles())
+const char* fileDir(size_t file);
+
+// append a file to files[] (its name is copied), return its index
+// does not check for duplicates; use findFile() first for that
+size_t pushFile(const char* filename);
+size_t pushFileN(const char* filename, size_t len);
+
+// return index of the file with the given name, or -1 if there isn't one
+ssize_t findFile(const char* filename);
+
+// add n files (before any others) without loading their names: name(i, &len)
+// points at the full name of file i (not NUL terminated), and is called by
+// fileName() as needed; the first findFile() or pushFile() loads them all,
+// since those need every name indexed
+void pushLazyFiles(size_t n, const char* (*name)(size_t file, size_t* len));
+
+// reorder files[] (and the label columns along with it) so that the file at
+// order[i] ends up at i; order is a permutation of 0 .. nFiles - 1
+void permuteFiles(const size_t* order);
+
 #endif
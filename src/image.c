@@ -0,0 +1,254 @@
+#define _GNU_SOURCE  // pipe2()
+#include "image.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// refuse anything bigger than this many pixels (a corrupt header shouldn't be
+// able to make us allocate gigabytes)
+static const size_t MAX_PIXELS = 1 << 28;
+
+// PNM (P2/P3/P5/P6)
+
+// skip whitespace and comments, then read an unsigned decimal number
+static int pnmNumber(const unsigned char** p, const unsigned char* end,
+        unsigned* n) {
+    while (*p < end) {
+        if (**p == '#') {
+            while (*p < end && **p != '\n') ++*p;
+        } else if (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r') {
+            ++*p;
+        } else {
+            break;
+        }
+    }
+    if (*p == end || **p < '0' || **p > '9') return 1;
+    *n = 0;
+    while (*p < end && **p >= '0' && **p <= '9') {
+        *n = *n * 10 + (**p - '0');
+        if (*n > 65535 * 256) return 1;
+        ++*p;
+    }
+    return 0;
+}
+
+static int decodePnm(const unsigned char* buf, size_t len,
+        struct image* img) {
+    const unsigned char *p = buf + 2, *end = buf + len;
+    int type = buf[1] - '0', channels = (type == 3 || type == 6) ? 3 : 1,
+        ascii = type == 2 || type == 3;
+    unsigned w, h, maxval;
+    if (pnmNumber(&p, end, &w) || pnmNumber(&p, end, &h) ||
+            pnmNumber(&p, end, &maxval)) {
+        return 1;
+    }
+    if (w == 0 || h == 0 || maxval == 0 || maxval > 65535 ||
+            (size_t)w * h > MAX_PIXELS) {
+        return 1;
+    }
+    // exactly one whitespace character separates the header from binary data
+    if (!ascii) {
+        if (p >= end) return 1;
+        ++p;
+    }
+    int bytes = maxval > 255 ? 2 : 1;
+    size_t n = (size_t)w * h * channels, i;
+    if (!ascii && n * bytes > (size_t)(end - p)) return 1;
+
+    img->w = w;
+    img->h = h;
+    img->rgb = malloc((size_t)w * h * 3);
+    for (i = 0; i < n; ++i) {
+        unsigned v;
+        if (ascii) {
+            if (pnmNumber(&p, end, &v)) {
+                imageFree(img);
+                return 1;
+            }
+        } else if (bytes == 2) {
+            v = (p[0] << 8) | p[1];
+            p += 2;
+        } else {
+            v = *p++;
+        }
+        unsigned char c = v >= maxval ? 255 : v * 255 / maxval;
+        if (channels == 3) {
+            img->rgb[i] = c;
+        } else {
+            img->rgb[i * 3] = img->rgb[i * 3 + 1] = img->rgb[i * 3 + 2] = c;
+        }
+    }
+    return 0;
+}
+
+// BMP (uncompressed, 1/4/8/24/32 bits per pixel)
+
+static uint32_t le32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int decodeBmp(const unsigned char* buf, size_t len,
+        struct image* img) {
+    if (len < 54) return 1;
+    uint32_t offset = le32(buf + 10), dibSize = le32(buf + 14);
+    int32_t w = le32(buf + 18), h = le32(buf + 22);
+    int bpp = buf[28] | (buf[29] << 8);
+    uint32_t compression = le32(buf + 30), nColors = le32(buf + 46);
+    int topDown = h < 0;
+    if (topDown) h = -h;
+
+    // (BI_BITFIELDS at 32 bpp is nearly always plain BGRA, so allow it)
+    if (compression != 0 && !(compression == 3 && bpp == 32)) return 1;
+    if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24 && bpp != 32) return 1;
+    if (w <= 0 || h <= 0 || (size_t)w * h > MAX_PIXELS) return 1;
+
+    // (in size_t, so a huge dibSize can't wrap around past the check)
+    if (dibSize > len - 14) return 1;
+    const unsigned char* palette = NULL;
+    if (bpp <= 8) {
+        if (nColors == 0 || nColors > (1u << bpp)) nColors = 1 << bpp;
+        if ((size_t)14 + dibSize + (size_t)nColors * 4 > len) return 1;
+        palette = buf + 14 + dibSize;
+    }
+    size_t stride = (((size_t)w * bpp + 31) / 32) * 4;
+    if (offset > len || stride * h > len - offset) return 1;
+
+    img->w = w;
+    img->h = h;
+    img->rgb = malloc((size_t)w * h * 3);
+    int x, y;
+    for (y = 0; y < h; ++y) {
+        const unsigned char* row = buf + offset +
+            stride * (topDown ? y : h - 1 - y);
+        unsigned char* out = img->rgb + (size_t)y * w * 3;
+        for (x = 0; x < w; ++x, out += 3) {
+            const unsigned char* bgr;
+            if (bpp >= 24) {
+                bgr = row + x * (bpp / 8);
+            } else {
+                int bit = x * bpp, idx = (row[bit / 8] >> (8 - bpp - bit % 8))
+                    & ((1 << bpp) - 1);
+                if (idx >= nColors) idx = 0;
+                bgr = palette + idx * 4;
+            }
+            out[0] = bgr[2];
+            out[1] = bgr[1];
+            out[2] = bgr[0];
+        }
+    }
+    return 0;
+}
+
+int imageDecode(const unsigned char* buf, size_t len, struct image* img) {
+    if (len >= 2 && buf[0] == 'P' && buf[1] >= '2' && buf[1] <= '6' &&
+            buf[1] != '4') {
+        return decodePnm(buf, len, img);
+    }
+    if (len >= 2 && buf[0] == 'B' && buf[1] == 'M') {
+        return decodeBmp(buf, len, img);
+    }
+    return 1;
+}
+
+// run IMG_CONVERTER on filename and decode what it writes
+static int convert(const char* converter, const char* filename,
+        struct image* img) {
+    // (close-on-exec, so converters started at the same time by other threads
+    // don't hold on to our pipe and keep us from seeing EOF; dup2() clears
+    // it on the child's stdout)
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return 1;
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_RDWR);
+        if (devNull == -1) _exit(127);
+        dup2(devNull, 0);
+        dup2(fds[1], 1);
+        dup2(devNull, 2);
+        execl("/bin/sh", "sh", "-c", converter, "sh", filename, (char*)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    size_t len = 0, cap = 1 << 16;
+    unsigned char* buf = malloc(cap);
+    ssize_t n;
+    while ((n = read(fds[0], buf + len, cap - len)) > 0) {
+        len += n;
+        if (len == cap) buf = realloc(buf, cap *= 2);
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+
+    int err = imageDecode(buf, len, img);
+    free(buf);
+    return err;
+}
+
+int imageLoad(const char* filename, struct image* img) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 1;
+
+    int err = imageDecode(map, st.st_size, img);
+    munmap(map, st.st_size);
+
+    char* converter = getenv("IMG_CONVERTER");
+    if (err && converter != NULL && *converter != '\0') {
+        err = convert(converter, filename, img);
+    }
+    return err;
+}
+
+void imageScale(const struct image* src, struct image* dst, int w, int h) {
+    dst->w = w;
+    dst->h = h;
+    dst->rgb = malloc((size_t)w * h * 3);
+    int x, y, c;
+    for (y = 0; y < h; ++y) {
+        // source rows [y0, y1) and columns [x0, x1) make up this pixel
+        int y0 = (long)y * src->h / h, y1 = (long)(y + 1) * src->h / h;
+        if (y1 <= y0) y1 = y0 + 1;
+        for (x = 0; x < w; ++x) {
+            int x0 = (long)x * src->w / w, x1 = (long)(x + 1) * src->w / w;
+            if (x1 <= x0) x1 = x0 + 1;
+            unsigned long sum[3] = {0, 0, 0};
+            int sx, sy;
+            for (sy = y0; sy < y1; ++sy) {
+                const unsigned char* p = src->rgb +
+                    ((size_t)sy * src->w + x0) * 3;
+                for (sx = x0; sx < x1; ++sx) {
+                    for (c = 0; c < 3; ++c) sum[c] += *p++;
+                }
+            }
+            unsigned long n = (unsigned long)(x1 - x0) * (y1 - y0);
+            for (c = 0; c < 3; ++c) {
+                dst->rgb[((size_t)y * w + x) * 3 + c] = sum[c] / n;
+            }
+        }
+    }
+}
+
+void imageFree(struct image* img) {
+    free(img->rgb);
+    img->rgb = NULL;
+}
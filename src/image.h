@@ -0,0 +1,27 @@
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stddef.h>
+
+// a decoded image, 3 bytes (r, g, b) per pixel, rows top to bottom
+struct image {
+    int w, h;
+    unsigned char* rgb;
+};
+
+// decode an image file; PPM/PGM (binary or ASCII) and uncompressed BMP are
+// read natively, anything else is piped through the command in the
+// environment variable IMG_CONVERTER (run by /bin/sh with the filename as $1;
+// it should write a PPM or BMP to stdout), if there is one
+// returns 0 on success
+int imageLoad(const char* filename, struct image* img);
+
+// decode an image already in memory (PPM/PGM/BMP only)
+int imageDecode(const unsigned char* buf, size_t len, struct image* img);
+
+// resize to exactly w by h pixels (averaging when shrinking)
+void imageScale(const struct image* src, struct image* dst, int w, int h);
+
+void imageFree(struct image* img);
+
+#endif
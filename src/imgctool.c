@@ -1,4 +1,5 @@
 #include <ncurses.h>  // also includes <stdio.h>
+#include <locale.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -13,10 +14,85 @@ size_t nCategories = 0;
 
 #include "interface.h"  // curses interface
 
+#include "ingest.h"  // finding images in args, directories and stdin
+
+#include "dedupe.h"  // finding copies of the same image
+
+#include "order.h"  // sorting files[] to read them faster
+
+#include "query.h"  // headless `imgctool query' and `imgctool stats'
+
+#include "merge.h"  // `imgctool merge', for combining shards
+
+#include "trace.h"  // opt-in latency tracing (IMG_TRACE)
+
 int main(int argc, char* argv[]) {
+    // subcommands, which don't need a terminal or image viewer
+    if (argc > 1 && strcmp(argv[1], "query") == 0) {
+        return query(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "stats") == 0) {
+        return stats(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+        return merge(argc - 1, argv + 1);
+    }
+
     // check arguments
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s [IMAGES...]\n", argv[0]);
+    int opt, readStdin = 0, dedupe = 0, reorder = 0;
+    enum orderKey orderKey;
+    unsigned shard = 0, nShards = 0;
+    char* shardFile = NULL;
+    while ((opt = getopt(argc, argv, "0do:S:")) != -1) {
+        switch (opt) {
+            case '0':
+                // also read NUL separated paths from stdin
+                readStdin = 1;
+                break;
+            case 'd':
+                // hash contents to find copies
+                dedupe = 1;
+                break;
+            case 'o':
+                // sort the files by where they are on disk (or back)
+                if (orderParse(optarg, &orderKey) != 0) {
+                    fprintf(stderr, "-o wants added, dir, inode or "
+                        "extent\n");
+                    return 1;
+                }
+                reorder = 1;
+                break;
+            case 'S':
+                // only label shard K of N, saving to a file of its own
+                if (sscanf(optarg, "%u/%u", &shard, &nShards) != 2 ||
+                        shard < 1 || shard > nShards) {
+                    fprintf(stderr, "-S wants K/N, with 1 <= K <= N\n");
+                    return 1;
+                }
+                // (next to the save file it's a shard of, which may be
+                // IMG_SAVE_FILE)
+                free(shardFile);
+                setSaveFile(NULL);
+                shardFile = malloc(strlen(saveFileName()) + 32);
+                sprintf(shardFile, "%s.shard-%u-of-%u", saveFileName(), shard,
+                    nShards);
+                setSaveFile(shardFile);
+                ingestShard(shard - 1, nShards);
+                break;
+            default:
+                argc = 0;  // (print usage)
+                break;
+        }
+    }
+    // (no images at all is fine too if there's a save file to resume)
+    if (argc == 0 || (argc <= optind && !readStdin &&
+            access(saveFileName(), F_OK) != 0)) {
+        fprintf(stderr, "usage: %s [-0d] [-o ORDER] [-S K/N] "
+            "[IMAGES|DIRECTORIES|PATTERNS...]\n"
+            "       %s query [-f lines|csv|json] [EXPRESSION]\n"
+            "       %s stats [-f lines|csv|json]\n"
+            "       %s merge SHARD...\n",
+            argv[0], argv[0], argv[0], argv[0]);
         return 1;
     }
 
@@ -24,54 +100,53 @@ int main(int argc, char* argv[]) {
     char* imgViewer = getenv("IMG_VIEWER");
     if (imgViewer == NULL) imgViewer = "display";
     printf("Using image viewer `%s'. To change, call %s with the environment "
-        "variable IMG_VIEWER set to a variable of your choice.\n",
-        imgViewer, argv[0]);
+        "variable IMG_VIEWER set to a variable of your choice (or `builtin' "
+        "to show images in the terminal).\n", imgViewer, argv[0]);
 
     // make sure image viewer exists
-    char* cmd = malloc((strlen(imgViewer) + 28) * sizeof(char));
-    sprintf(cmd, "command -v %s >/dev/null 2>&1", imgViewer);
-    if (system(cmd) != 0) {
-        fprintf(stderr, "fatal: image viewer `%s' does not exist, aborting\n",
-            imgViewer);
-        return 1;
-    }
-    free(cmd);
-
-    // check files
-    int i, err = 0;
-    for (i = 1; i < argc; ++i) {
-        if (access(argv[i], R_OK) == -1) {
-            fprintf(stderr, "%s: file does not exist\n", argv[i]);
-            err = 1;
+    if (strcmp(imgViewer, "builtin") != 0) {
+        char* cmd = malloc((strlen(imgViewer) + 28) * sizeof(char));
+        sprintf(cmd, "command -v %s >/dev/null 2>&1", imgViewer);
+        if (system(cmd) != 0) {
+            fprintf(stderr, "fatal: image viewer `%s' does not exist, "
+                "aborting\n", imgViewer);
+            return 1;
         }
+        free(cmd);
     }
-    if (err) return 1;
 
-    // read existing data
+    // read existing data (making sure nobody else is working on it)
+    if (lockSaveFile() != 0) {
+        fprintf(stderr, "fatal: %s is already open in another imgctool, "
+            "aborting\n", saveFileName());
+        return 1;
+    }
     if (restore() != 0) {
         // an error happened somewhere
         return 1;
     }
 
-    // add files
-    // TODO make this more efficient, not 2 allocs per file
-    int j, skipFile = 0;
-    for (i = 1; i < argc; ++i) {
-        // do not add if this file already exists
-        for (j = 0; j < nFiles; ++j) {
-            if (strcmp(files[j].filename, argv[i]) == 0) {
-                skipFile = 1;
-                break;
-            }
-        }
-        if (!skipFile) {
-            files = realloc(files, (++nFiles) * sizeof(struct ictFile));
-            files[nFiles - 1].filename = calloc(strlen(argv[i]) + 1,
-                sizeof(char));
-            strcpy(files[nFiles - 1].filename, argv[i]);
-            files[nFiles - 1].data = 0;
-        }
-        skipFile = 0;
+    // check and add files
+    // (findFile() is a hash lookup and pushFile() grows files[] geometrically,
+    // so this stays linear even when merging into a large restored set)
+    // (when just resuming, there's nothing to check, and so the names of
+    // restored files needn't even be loaded; see pushLazyFiles())
+    if ((argc > optind || readStdin) &&
+            ingest(argv + optind, argc - optind, readStdin) != 0) {
+        return 1;
+    }
+
+    if (nFiles == 0) {
+        fprintf(stderr, "fatal: no images found, aborting\n");
+        return 1;
+    }
+    if (reorder) orderFiles(orderKey);
+    if (dedupe) dedupeFiles();
+
+    // the file list used up stdin, so talk to the terminal directly
+    if (readStdin && freopen("/dev/tty", "r", stdin) == NULL) {
+        fprintf(stderr, "fatal: can't open /dev/tty, aborting\n");
+        return 1;
     }
 
     // finally ready to start!
@@ -79,16 +154,24 @@ int main(int argc, char* argv[]) {
     getchar();
 
     // set up ncurses
+    setlocale(LC_ALL, "");  // so UTF-8 output (for the preview) works
     initscr();  // initialize screen
     raw();      // disable line buffering, get all keys (including ex. ctrl+C)
     keypad(stdscr, TRUE);  // handling of F1, F2, arrow keys, etc.
     noecho();   // turn off echoing when a key is pressed
     refresh();
 
-    interfaceGo(imgViewer);
+    traceInit();
+    int err = interfaceGo(imgViewer);
 
     // cleanup ncurses
     endwin();
+    traceQuit();  // (once the terminal is back to normal)
 
+    if (err) {
+        fprintf(stderr, "error: couldn't save labels to %s; changes since "
+            "the last save are lost\n", saveFileName());
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,335 @@
+#include "ingest.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ictdata.h"
+
+static const char DEFAULT_EXTENSIONS[] =
+    "png,jpg,jpeg,gif,bmp,ppm,pgm,pbm,pnm,tif,tiff,webp";
+// args are checked in chunks of this many per job
+static const size_t CHUNK = 4096;
+
+// A batch is a list of names found by one job. Batches are added to files[]
+// in (seq, dir) order, where seq is the position of the arg that led to it;
+// so args keep their order, and a directory's contents come out sorted no
+// matter which thread got to what first.
+struct batch {
+    size_t seq;
+    char* dir;     // directory the names are in, or NULL for args themselves
+    char** names;
+    size_t n, cap;
+};
+
+struct job {
+    size_t seq;
+    char* dir;     // directory to walk, or NULL
+    char** args;   // otherwise, args[0 .. nArgs) to check
+    size_t nArgs;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+// all protected by lock
+static struct job* jobs = NULL;
+static size_t nJobs = 0, jobsCap = 0, busy = 0;
+static struct batch* batches = NULL;
+static size_t nBatches = 0, batchesCap = 0;
+static int missing = 0;
+
+static char** extensions = NULL;
+static size_t nExtensions = 0;
+
+// see ingestShard()
+static size_t shardIndex = 0, nShards = 1;
+
+static void pushJob(struct job job) {
+    pthread_mutex_lock(&lock);
+    if (nJobs == jobsCap) {
+        jobsCap = jobsCap ? jobsCap * 2 : 64;
+        jobs = realloc(jobs, jobsCap * sizeof(struct job));
+    }
+    jobs[nJobs++] = job;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+static void batchAdd(struct batch* b, char* name) {
+    if (b->n == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 16;
+        b->names = realloc(b->names, b->cap * sizeof(char*));
+    }
+    b->names[b->n++] = name;
+}
+
+static void finishBatch(struct batch* b) {
+    if (b->n != 0) {
+        pthread_mutex_lock(&lock);
+        if (nBatches == batchesCap) {
+            batchesCap = batchesCap ? batchesCap * 2 : 64;
+            batches = realloc(batches, batchesCap * sizeof(struct batch));
+        }
+        batches[nBatches++] = *b;
+        pthread_mutex_unlock(&lock);
+    } else {
+        free(b->names);
+        free(b->dir);
+    }
+}
+
+static int hasImageExtension(const char* name) {
+    const char* dot = strrchr(name, '.');
+    size_t i;
+    if (dot == NULL) return 0;
+    for (i = 0; i < nExtensions; ++i) {
+        if (strcasecmp(dot + 1, extensions[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static char* joinPath(const char* dir, const char* name) {
+    size_t dLen = strlen(dir), nLen = strlen(name);
+    char* path = malloc(dLen + nLen + 2);
+    memcpy(path, dir, dLen);
+    if (dLen == 0 || dir[dLen - 1] != '/') path[dLen++] = '/';
+    memcpy(path + dLen, name, nLen + 1);
+    return path;
+}
+
+static int inShard(const char* path) {
+    if (nShards == 1) return 1;
+    // FNV-1a, which only has to be the same everywhere, not good
+    uint64_t h = 14695981039346656037ULL;
+    for (; *path; ++path) h = (h ^ (unsigned char)*path) * 1099511628211ULL;
+    return h % nShards == shardIndex;
+}
+
+static int compareNames(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void walkDir(size_t seq, char* dir) {
+    int fd = openat(AT_FDCWD, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* d = fd == -1 ? NULL : fdopendir(fd);
+    if (d == NULL) {
+        if (fd != -1) close(fd);
+        fprintf(stderr, "%s: can't read directory\n", dir);
+        free(dir);
+        return;
+    }
+
+    struct batch b = {seq, dir, NULL, 0, 0};
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        int type = ent->d_type;
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+            // (symlinks to directories aren't followed, to avoid loops)
+            struct stat st;
+            if (type == DT_LNK || fstatat(fd, ent->d_name, &st,
+                    AT_SYMLINK_NOFOLLOW) != 0) {
+                type = DT_REG;
+            } else {
+                type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+            }
+        }
+        if (type == DT_DIR) {
+            struct job job = {seq, joinPath(dir, ent->d_name), NULL, 0};
+            pushJob(job);
+        } else if (hasImageExtension(ent->d_name)) {
+            char* name = malloc(strlen(ent->d_name) + 1);
+            strcpy(name, ent->d_name);
+            batchAdd(&b, name);
+        }
+    }
+    closedir(d);
+
+    qsort(b.names, b.n, sizeof(char*), compareNames);
+    finishBatch(&b);
+}
+
+static void checkArgs(size_t seq, char** args, size_t n) {
+    struct batch b = {seq, NULL, NULL, 0, 0};
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        struct stat st;
+        if (stat(args[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            // files after this one sort after the directory's contents
+            finishBatch(&b);
+            b = (struct batch){seq + i + 1, NULL, NULL, 0, 0};
+
+            char* dir = malloc(strlen(args[i]) + 1);
+            strcpy(dir, args[i]);
+            struct job job = {seq + i, dir, NULL, 0};
+            pushJob(job);
+        } else if (access(args[i], R_OK) == 0) {
+            batchAdd(&b, args[i]);
+        } else {
+            fprintf(stderr, "%s: file does not exist\n", args[i]);
+            pthread_mutex_lock(&lock);
+            missing = 1;
+            pthread_mutex_unlock(&lock);
+        }
+    }
+    finishBatch(&b);
+}
+
+static void* worker(void* arg) {
+    pthread_mutex_lock(&lock);
+    while (1) {
+        while (nJobs == 0 && busy != 0) pthread_cond_wait(&wake, &lock);
+        if (nJobs == 0) break;  // nothing left, and nobody can add more
+
+        struct job job = jobs[--nJobs];
+        ++busy;
+        pthread_mutex_unlock(&lock);
+
+        if (job.dir != NULL) walkDir(job.seq, job.dir);
+        else checkArgs(job.seq, job.args, job.nArgs);
+
+        pthread_mutex_lock(&lock);
+        if (--busy == 0 && nJobs == 0) pthread_cond_broadcast(&wake);
+    }
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static int compareBatches(const void* a, const void* b) {
+    const struct batch *x = a, *y = b;
+    if (x->seq != y->seq) return x->seq < y->seq ? -1 : 1;
+    if (x->dir == NULL || y->dir == NULL) return (x->dir != NULL) -
+        (y->dir != NULL);
+    return strcmp(x->dir, y->dir);
+}
+
+// read NUL separated args from stdin
+static char** readStdinArgs(size_t* n) {
+    size_t len = 0, cap = 1 << 16, i;
+    char* buf = malloc(cap);
+    size_t got;
+    while ((got = fread(buf + len, 1, cap - len - 1, stdin)) > 0) {
+        len += got;
+        if (len + 1 == cap) buf = realloc(buf, cap *= 2);
+    }
+    buf[len] = '\0';
+
+    char** args = NULL;
+    size_t argsCap = 0;
+    *n = 0;
+    for (i = 0; i < len; i += strlen(buf + i) + 1) {
+        if (buf[i] == '\0') continue;
+        if (*n == argsCap) {
+            argsCap = argsCap ? argsCap * 2 : 1024;
+            args = realloc(args, argsCap * sizeof(char*));
+        }
+        args[(*n)++] = buf + i;
+    }
+    return args;
+}
+
+// replace args that look like glob patterns (and aren't existing files) with
+// what they match
+static char** expandGlobs(char** args, size_t* n) {
+    char** out = malloc(*n * sizeof(char*));
+    size_t nOut = 0, cap = *n, i, j;
+    for (i = 0; i < *n; ++i) {
+        glob_t g;
+        if (strpbrk(args[i], "*?[") == NULL || access(args[i], F_OK) == 0 ||
+                glob(args[i], 0, NULL, &g) != 0) {
+            out[nOut++] = args[i];
+            continue;
+        }
+        // (the matches are never freed; they end up in files[] anyway)
+        if (nOut + g.gl_pathc + (*n - i - 1) > cap) {
+            cap = (nOut + g.gl_pathc + (*n - i - 1)) * 2;
+            out = realloc(out, cap * sizeof(char*));
+        }
+        for (j = 0; j < g.gl_pathc; ++j) out[nOut++] = g.gl_pathv[j];
+    }
+    free(args);
+    *n = nOut;
+    return out;
+}
+
+void ingestShard(size_t index, size_t count) {
+    shardIndex = index;
+    nShards = count;
+}
+
+int ingest(char** argv, int argc, int readStdin) {
+    // which extensions count as images when walking directories
+    const char* extEnv = getenv("IMG_EXTENSIONS");
+    char* ext = strdup(extEnv != NULL ? extEnv : DEFAULT_EXTENSIONS);
+    char* tok;
+    for (tok = strtok(ext, ", "); tok != NULL; tok = strtok(NULL, ", ")) {
+        extensions = realloc(extensions, (nExtensions + 1) * sizeof(char*));
+        extensions[nExtensions++] = tok[0] == '.' ? tok + 1 : tok;
+    }
+
+    // collect args
+    size_t nArgs = argc, nStdin = 0, i;
+    char** stdinArgs = readStdin ? readStdinArgs(&nStdin) : NULL;
+    char** args = malloc((nArgs + nStdin) * sizeof(char*));
+    memcpy(args, argv, nArgs * sizeof(char*));
+    memcpy(args + nArgs, stdinArgs, nStdin * sizeof(char*));
+    nArgs += nStdin;
+    args = expandGlobs(args, &nArgs);
+
+    for (i = 0; i < nArgs; i += CHUNK) {
+        struct job job = {i, NULL, args + i,
+            nArgs - i < CHUNK ? nArgs - i : CHUNK};
+        pushJob(job);
+    }
+
+    // run the pool
+    char* threadsEnv = getenv("IMG_THREADS");
+    long nThreads = threadsEnv != NULL ? atol(threadsEnv) :
+        sysconf(_SC_NPROCESSORS_ONLN);
+    if (nThreads < 1) nThreads = 1;
+    pthread_t* threads = malloc(nThreads * sizeof(pthread_t));
+    busy = 1;  // (so no worker quits before the others have started)
+    for (i = 0; i < nThreads; ++i) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    pthread_mutex_lock(&lock);
+    if (--busy == 0) pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+    for (i = 0; i < nThreads; ++i) pthread_join(threads[i], NULL);
+    free(threads);
+
+    // add everything that was found, in order
+    qsort(batches, nBatches, sizeof(struct batch), compareBatches);
+    size_t j;
+    for (i = 0; i < nBatches; ++i) {
+        struct batch* b = &batches[i];
+        for (j = 0; j < b->n; ++j) {
+            char* path = b->dir == NULL ? b->names[j] :
+                joinPath(b->dir, b->names[j]);
+            // do not add if this file already exists (or is someone else's)
+            if (inShard(path) && findFile(path) == -1) pushFile(path);
+            if (b->dir != NULL) {
+                free(path);
+                free(b->names[j]);
+            }
+        }
+        free(b->names);
+        free(b->dir);
+    }
+    free(batches);
+    batches = NULL;
+    nBatches = batchesCap = 0;
+    free(args);
+
+    return missing;
+}
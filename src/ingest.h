@@ -0,0 +1,20 @@
+#ifndef __INGEST_H__
+#define __INGEST_H__
+
+#include <stddef.h>
+
+// add images to files[] (skipping ones that are already there)
+// every arg can be an image, a directory (searched recursively for files with
+// an image extension, see IMG_EXTENSIONS) or a glob pattern; if readStdin is
+// set, more args are read from stdin, separated by NULs
+// the checking and directory walking is spread over IMG_THREADS threads
+// (default: one per CPU); returns nonzero if any arg didn't exist
+int ingest(char** args, int nArgs, int readStdin);
+
+// from now on, only add the files that fall in shard `index' (counting from
+// 0) of `count': each file is in one shard, picked by a hash of its name, so
+// everyone working from the same directory on the same args gets a different
+// slice of the same set
+void ingestShard(size_t index, size_t count);
+
+#endif
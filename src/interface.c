@@ -5,45 +5,83 @@
 
 #include "ictdata.h"
 #include "saverestore.h"
+#include "journal.h"
+#include "viewer.h"
+#include "prefetch.h"
+#include "preview.h"
+#include "layout.h"
+#include "bulk.h"
+#include "jump.h"
+#include "query.h"
+#include "stats.h"
+#include "dedupe.h"
+#include "suggest.h"
+#include "autosave.h"
+#include "trace.h"
 
 static const char* CONTROLS[] = {
     "A/D/R: add/del/rename category", "a/d/r: add/del/rename chkbox",
     "j/k: category down/up", "h/l: checkbox left/right",
     "space: toggle checkbox", "n/p: next/previous image",
-    "q/ctrl+c: save and quit", "w/ctrl+s: save"
+    "q/ctrl+c: save and quit", "w/ctrl+s: save",
+    "<N>j/k/h/l/n/p: move N times", "v: start/cancel range select",
+    "m: set checkbox by pattern", "s: show/hide counts",
+    "u/U: next/prev unlabeled", "c/C: next/prev empty category",
+    "f/g/G: set/next/prev filter", "y: accept suggestions [?]"
 };
 static const int NCONTROLS = sizeof(CONTROLS) / sizeof(char*);
 static const int CONTROL_LEN = 32;  // max len of str in CONTROLS + 2 (padding)
-
-static WINDOW *mainWin, *helpWin, *fileWin, *inputPopup;
-static struct cpos {
-    int y;
-    int x;
-    int categoryIdx;
-    int chkboxIdx;
-    int relChkboxIdx;
-}* cursorPositions;
-static int nCpos = 0, cposIdx = 0;
+static const int PREVIEW_POLL_MS = 30;
+static const int STATS_WIDTH = 32;
+static const int MAX_COUNT = 1000000;  // count prefixes are capped at this
+
+static WINDOW *mainWin, *helpWin, *fileWin, *inputPopup, *previewWin,
+    *statsWin;
+static int cposIdx = 0;
+static int layoutDirty = 1;      // see updateMainWin()
+static char* drawnMarks = NULL;  // mark on screen for each cursor position
 #define CPOS cursorPositions[cposIdx]
 #define CCAT categories[CPOS.categoryIdx]
 
 static int fileIdx = 0;
+// first file of the range being selected with v, or -1 if there isn't one
+static int rangeStart = -1;
+// result of the last bulk operation, shown next to the file name
+static char status[80] = "";
 
-static char* imgViewer;
-static void updateImage() {
-    char* buf;
+// whether the last key was a quit whose save failed (so quitting again goes
+// through with it)
+static int quitUnsaved = 0;
+// the expression g/G jump to (see query.h), or NULL before f sets one
+static char* filterExpr = NULL;
+
+// whether images are shown in previewWin rather than by an external viewer
+static int builtinViewer = 0;
+
+// the file the suggestions (see suggest.h) were worked out for, and whether
+// they're still waiting on its thumbnail
+static int suggestFile = -1;
+static int suggestWaiting = 0;
 
-    buf = malloc((strlen(imgViewer) + 25) * sizeof(char));
-    sprintf(buf, "killall %s >/dev/null 2>&1", imgViewer);
-    system(buf);
-    free(buf);
+// whether statsWin is shown, and the category it starts at
+static int showStats = 1;
+static int statsFrom = 0;
+
+static void updateCursor();
+
+static void updateImage() {
+    uint64_t t = traceBegin();
+    prefetchHint(fileIdx);
+    if (builtinViewer) {
+        previewShow(fileIdx);
+        // poll for the rendered frame instead of blocking on the next key
+        timeout(PREVIEW_POLL_MS);
+        updateCursor();
+        traceEnd(TRACE_IMAGE, t, 0);
+        return;
+    }
 
-    buf = malloc((strlen(imgViewer) + strlen(files[fileIdx].filename) + 18)
-        * sizeof(char));
-    sprintf(buf, "%s %s >/dev/null 2>&1 &", imgViewer,
-        files[fileIdx].filename);
-    system(buf);
-    free(buf);
+    viewerShow(fileName(fileIdx));
 
     // a little (ugly) special-casing for i3
     // (we expect to be running as a floating window)
@@ -51,75 +89,132 @@ static void updateImage() {
             (strcmp(getenv("DESKTOP_SESSION"), "i3") == 0)) {
         system("( sleep 0.25; i3-msg 'focus mode_toggle' ) >/dev/null 2>&1 &");
     }
+    traceEnd(TRACE_IMAGE, t, 0);
 }
 
+// the file `count' files after (before, if negative) the current one,
+// skipping copies of files that come earlier (see dedupe.h); stops at the
+// first/last file
+static int stepFile(int count) {
+    int file = fileIdx, f, step = count < 0 ? -1 : 1;
+    for (; count != 0; count -= step) {
+        for (f = file + step; f >= 0 && f < nFiles && dupFirst(f) != f;
+                f += step);
+        if (f < 0 || f >= nFiles) break;
+        file = f;
+    }
+    return file;
+}
+
+// the check mark for cursor position i, in the current file (? for a
+// suggestion)
+static char mark(int i) {
+    int bit = cursorPositions[i].chkboxIdx;
+    return getLabel(fileIdx, bit) ? 'x' : suggested(bit) ? '?' : ' ';
+}
+
+// redraw the categories window
+// only marks that changed since the last call are repainted, unless
+// layoutDirty is set (because categories/checkboxes or the window size
+// changed), in which case everything is laid out and drawn from scratch
 static void updateMainWin() {
-    wmove(mainWin, 1, 1);
-    free(cursorPositions);
-    cursorPositions = NULL;
-    nCpos = 0;
-    int i, j, chkboxCount = 0;
-    for (i = 0; i < nCategories; ++i) {
+    uint64_t t = traceBegin();
+    int i;
+    // (suggestions are per file, and checkboxes may have moved)
+    if (fileIdx != suggestFile || layoutDirty) {
+        suggestFile = fileIdx;
+        suggestWaiting = suggestUpdate(fileIdx);
+        if (suggestWaiting) timeout(PREVIEW_POLL_MS);
+    }
+    if (layoutDirty) {
+        layoutBuild(getmaxx(mainWin));
+        drawnMarks = realloc(drawnMarks, nCpos);
+        if (cposIdx >= nCpos) cposIdx = nCpos - 1;
+
+        werase(mainWin);
         wattron(mainWin, A_BOLD);
-        waddstr(mainWin, categories[i].name);
+        for (i = 0; i < nCategories; ++i) {
+            mvwaddstr(mainWin, categoryRows[i], 1, categories[i].name);
+        }
         wattroff(mainWin, A_BOLD);
-
-        int idx = nCpos;
-        nCpos += (categories[i].nChkboxes == 0 ? 1 : categories[i].nChkboxes);
-        cursorPositions = realloc(cursorPositions, nCpos * sizeof(struct cpos));
-
-        int y, x; getyx(mainWin, y, x);
-        for (j = 0; j < categories[i].nChkboxes; ++j) {
-            if ((x + 6 + strlen(categories[i].chkboxes[j])) > (COLS - 1)) {
-                // wrap
-                waddstr(mainWin, "\n ");
-                cursorPositions[idx].y = y + 1;
-                cursorPositions[idx].x = 3;
-            } else {
-                cursorPositions[idx].y = y;
-                cursorPositions[idx].x = x + 3;
+        for (i = 0; i < nCpos; ++i) {
+            struct cpos* c = &cursorPositions[i];
+            if (c->chkboxIdx == -1) continue;
+            drawnMarks[i] = mark(i);
+            mvwprintw(mainWin, c->y, c->x - 3, "  [%c] ", drawnMarks[i]);
+            waddstr(mainWin, categories[c->categoryIdx].chkboxes[
+                c->relChkboxIdx]);
+        }
+        box(mainWin, 0, 0);
+        mvwprintw(mainWin, 0, 2, "categories");
+        layoutDirty = 0;
+    } else {
+        for (i = 0; i < nCpos; ++i) {
+            if (cursorPositions[i].chkboxIdx == -1) continue;
+            char m = mark(i);
+            if (m != drawnMarks[i]) {
+                mvwaddch(mainWin, cursorPositions[i].y, cursorPositions[i].x,
+                    m);
+                drawnMarks[i] = m;
             }
-            cursorPositions[idx].categoryIdx = i;
-            cursorPositions[idx].chkboxIdx = chkboxCount;
-            cursorPositions[idx].relChkboxIdx = j;
-            ++idx;
+        }
+    }
+    wmove(mainWin, CPOS.y, CPOS.x);
+    wrefresh(mainWin);
+    traceEnd(TRACE_MAIN_WIN, t, 0);
+}
+
+// just move the cursor in the categories window
+static void updateCursor() {
+    wmove(mainWin, CPOS.y, CPOS.x);
+    wrefresh(mainWin);
+}
 
-            wprintw(mainWin, "  [%c] ", (files[fileIdx].data >> chkboxCount)
-                & 1 ? 'x' : ' ');
-            waddstr(mainWin, categories[i].chkboxes[j]);
+// one line of statsWin: a name on the left, a count on the right
+static void statsLine(int y, int indent, const char* name, size_t count) {
+    char num[24];
+    int w = getmaxx(statsWin),
+        len = snprintf(num, sizeof(num), "%zu", count);
+    mvwaddnstr(statsWin, y, 1 + indent, name, w - 3 - indent - len);
+    mvwaddstr(statsWin, y, w - 1 - len, num);
+}
 
-            getyx(mainWin, y, x);
-            ++chkboxCount;
+// show the counts of checkboxes from the cursor's category onwards (as many
+// as fit)
+static void updateStatsWin() {
+    if (!showStats) return;
+    uint64_t t = traceBegin();
+    int h = getmaxy(statsWin), y = 1;
+    size_t i, j, bit = 0;
+    // (no cursor positions yet when this is first drawn)
+    statsFrom = nCategories && nCpos ? CPOS.categoryIdx : 0;
+
+    werase(statsWin);
+    statsLine(y++, 0, "files", nFiles);
+    statsLine(y++, 0, "unlabeled", nUnlabeled);
+    for (i = 0; i < nCategories; ++i) {
+        if (i < statsFrom) {
+            bit += categories[i].nChkboxes;
+            continue;
         }
-        if (categories[i].nChkboxes == 0) {
-            // allow the cursor to go to (y, 1) (start of name)
-            cursorPositions[idx].y = y;
-            cursorPositions[idx].x = 1;
-            cursorPositions[idx].categoryIdx = i;
-            cursorPositions[idx].chkboxIdx = -1;
-            cursorPositions[idx].relChkboxIdx = -1;
+        if (y >= h - 1) break;
+        wattron(statsWin, A_BOLD);
+        mvwaddnstr(statsWin, y++, 1, categories[i].name,
+            getmaxx(statsWin) - 2);
+        wattroff(statsWin, A_BOLD);
+        for (j = 0; j < categories[i].nChkboxes && y < h - 1; ++j, ++bit) {
+            statsLine(y++, 2, categories[i].chkboxes[j], chkboxCounts[bit]);
         }
-
-        // go to next line
-        waddstr(mainWin, "\n ");
-    }
-    if (nCategories == 0) {
-        // fine, the cursor can go to (1, 1)
-        cursorPositions = malloc(sizeof(struct cpos));
-        cursorPositions[0].y = 1;
-        cursorPositions[0].x = 1;
-        cursorPositions[0].categoryIdx = -1;
-        cursorPositions[0].chkboxIdx = -1;
-        cursorPositions[0].relChkboxIdx = -1;
     }
-    box(mainWin, 0, 0);
-    mvwprintw(mainWin, 0, 2, "categories");
-    wmove(mainWin, CPOS.y, CPOS.x);
-    wrefresh(mainWin);
+    box(statsWin, 0, 0);
+    mvwprintw(statsWin, 0, 2, "counts");
+    wrefresh(statsWin);
+    traceEnd(TRACE_STATS_WIN, t, 0);
 }
 
 static void updateHelpWin() {
     int i;
+    werase(helpWin);
     for (i = 0; i < NCONTROLS; ++i) {
         mvwprintw(helpWin, 1 + i / (COLS / CONTROL_LEN),
             1 + CONTROL_LEN * (i % (COLS / CONTROL_LEN)), CONTROLS[i]);
@@ -130,12 +225,23 @@ static void updateHelpWin() {
 }
 
 static void updateFileWin() {
+    uint64_t t = traceBegin();
     wclear(fileWin);
-    mvwprintw(fileWin, 1, 1, "%s (%i of %i)", files[fileIdx].filename,
+    mvwprintw(fileWin, 1, 1, "%s (%i of %i)", fileName(fileIdx),
         fileIdx + 1, nFiles);
+    if (rangeStart != -1) {
+        wprintw(fileWin, " [range: %i files]", abs(fileIdx - rangeStart) + 1);
+    }
+    size_t copy, nCopies = 0;
+    for (copy = dupNext(fileIdx); copy != fileIdx; copy = dupNext(copy)) {
+        ++nCopies;
+    }
+    if (nCopies) wprintw(fileWin, " [+%zu copies]", nCopies);
+    if (status[0] != '\0') wprintw(fileWin, " -- %s", status);
     box(fileWin, 0, 0);
     mvwprintw(fileWin, 0, 2, "current file");
     wrefresh(fileWin);
+    traceEnd(TRACE_FILE_WIN, t, 0);
 }
 
 static void (*inputCallback)(char* s);
@@ -155,70 +261,302 @@ static void getInput(void (*cb)(char* s), char* prompt) {
 }
 
 static void cbAddCategory(char* s) {
-    categories = realloc(categories, (++nCategories) *
-        sizeof(struct ictCategory));
-    categories[nCategories - 1].name = calloc(strlen(s)+1, sizeof(char));
-    strcpy(categories[nCategories - 1].name, s);
-    categories[nCategories - 1].chkboxes = NULL;
-    categories[nCategories - 1].nChkboxes = 0;
+    pushCategory(s, strlen(s));
+    journalInvalidate();
+    autosaveEdited();
+    layoutDirty = 1;
+    updateStatsWin();
     updateMainWin();  // display new category
 }
 
 static void cbAddChkbox(char* s) {
-    CCAT.chkboxes = realloc(CCAT.chkboxes, (++CCAT.nChkboxes) * sizeof(char*));
-    CCAT.chkboxes[CCAT.nChkboxes - 1] = calloc(strlen(s)+1, sizeof(char));
-    strcpy(CCAT.chkboxes[CCAT.nChkboxes - 1], s);
+    if (CPOS.categoryIdx == -1) return;  // nothing to add it to
+    pushChkbox(&CCAT, s, strlen(s));
+
+    // (it goes at the end of its category)
+    size_t bit = categoryFirstBit(CPOS.categoryIdx) + CCAT.nChkboxes - 1;
+    insertLabelColumn(bit);
+    statsChkboxAdded(bit);
+    journalInvalidate();
+    autosaveEdited();
+    layoutDirty = 1;
+    updateStatsWin();
     updateMainWin();  // display new checkbox
 }
 
 static void cbDelCategory(char* s) {
     if (s[0] == 'y' && nCategories > 0) {
+        size_t first = categoryFirstBit(CPOS.categoryIdx),
+               bit = first + CCAT.nChkboxes;
+        while (bit-- > first) {
+            statsChkboxDeleted(bit);
+            deleteLabelColumn(bit);
+        }
         memmove(categories + CPOS.categoryIdx,
             categories + CPOS.categoryIdx + 1,
             (nCategories - CPOS.categoryIdx - 1) * sizeof(struct ictCategory));
         --nCategories;
-        categories = realloc(categories, nCategories * sizeof(struct ictCategory));
         if (cposIdx > 0) --cposIdx;
+        journalInvalidate();
+        autosaveEdited();
     }
-    wclear(mainWin);
+    layoutDirty = 1;
+    updateStatsWin();
     updateMainWin();
 }
 
 static void cbDelChkbox(char* s) {
     if (s[0] == 'y' && CPOS.relChkboxIdx != -1) {
+        statsChkboxDeleted(CPOS.chkboxIdx);
+        deleteLabelColumn(CPOS.chkboxIdx);
         memmove(CCAT.chkboxes + CPOS.relChkboxIdx,
             CCAT.chkboxes + CPOS.relChkboxIdx + 1,
             (CCAT.nChkboxes - CPOS.relChkboxIdx - 1) * sizeof(char*));
         --CCAT.nChkboxes;
-        CCAT.chkboxes = realloc(CCAT.chkboxes, CCAT.nChkboxes * sizeof(char*));
         if (cposIdx > 0) --cposIdx;
+        journalInvalidate();
+        autosaveEdited();
+    }
+
+    layoutDirty = 1;
+    updateStatsWin();
+    updateMainWin();
+}
+
+static void cbMatch(char* s) {
+    enum bulkOp op;
+    switch (s[0]) {
+        case '+': op = BULK_SET; break;
+        case '-': op = BULK_CLEAR; break;
+        case '~': op = BULK_TOGGLE; break;
+        default:
+            snprintf(status, sizeof(status), "start with + (set), - (clear) "
+                "or ~ (toggle)");
+            updateFileWin();
+            return;
+    }
+    if (CPOS.chkboxIdx == -1) {
+        snprintf(status, sizeof(status), "no checkbox under the cursor");
+        updateFileWin();
+        return;
+    }
+
+    uint64_t* selected = bulkSelectMatch(s + 1);
+    if (selected == NULL) {
+        snprintf(status, sizeof(status), "bad pattern");
+    } else {
+        size_t changed = bulkApply(selected, CPOS.chkboxIdx, op);
+        if (changed) autosaveEdited();
+        snprintf(status, sizeof(status), "%zu files matched, %zu changed",
+            bulkCount(selected), changed);
+        free(selected);
+    }
+    updateFileWin();
+    updateStatsWin();
+    updateMainWin();
+}
+
+// move `count' jumps (see jump.h) forward, or backward if it's negative,
+// saying so if we run out of files first; `what' is the files being jumped
+// to, for that message
+static void jump(enum jumpKind kind, int count, const char* what) {
+    int file = fileIdx, step = count < 0 ? -1 : 1;
+    ssize_t next;
+    for (; count != 0; count -= step) {
+        next = jumpFind(kind, CPOS.categoryIdx, file, step);
+        if (next == -1) break;
+        file = next;
+    }
+    if (count != 0) {
+        snprintf(status, sizeof(status), "no %s %s this one", what,
+            step > 0 ? "after" : "before");
+    } else {
+        status[0] = '\0';
+    }
+    if (file == fileIdx) {
+        updateFileWin();
+        return;
+    }
+    fileIdx = file;
+    updateFileWin();
+    updateMainWin();
+    updateImage();
+}
+
+// jump to the next/previous file with nothing checked in the category under
+// the cursor
+static void jumpCategory(int count) {
+    char what[64];
+    if (CPOS.categoryIdx == -1) return;
+    snprintf(what, sizeof(what), "files without any %s", CCAT.name);
+    jump(JUMP_CATEGORY, count, what);
+}
+
+// jump to the next/previous file matching the filter
+static void jumpFilter(int count) {
+    if (filterExpr == NULL) {
+        snprintf(status, sizeof(status), "no filter (set one with f)");
+        updateFileWin();
+        return;
+    }
+    // (compiled again each time, in case checkboxes moved since)
+    const char* err = queryCompile(filterExpr);
+    if (err != NULL) {
+        snprintf(status, sizeof(status), "%s", err);
+        updateFileWin();
+        return;
+    }
+    jump(JUMP_FILTER, count, "matching files");
+}
+
+static void cbFilter(char* s) {
+    if (s[0] == '\0') {
+        free(filterExpr);
+        filterExpr = NULL;
+        snprintf(status, sizeof(status), "filter cleared");
+        updateFileWin();
+        return;
     }
-    wclear(mainWin);
+    const char* err = queryCompile(s);
+    if (err != NULL) {
+        snprintf(status, sizeof(status), "%s", err);
+        updateFileWin();
+        return;
+    }
+    free(filterExpr);
+    filterExpr = strdup(s);
+    jumpFilter(1);
+}
+
+// check every suggested checkbox on the current file
+static void acceptSuggestions() {
+    size_t bit, nBits = chkboxCount(), accepted = 0;
+    for (bit = 0; bit < nBits; ++bit) {
+        if (getLabel(fileIdx, bit) || !suggested(bit)) continue;
+        setLabel(fileIdx, bit, 1);
+        journalLabel(fileIdx, bit, 1);
+        statsLabelChanged(fileIdx, bit, 1);
+        dedupePropagate(fileIdx, bit);
+        ++accepted;
+    }
+    if (accepted) autosaveEdited();
+    snprintf(status, sizeof(status), "%zu suggestions accepted", accepted);
+    updateFileWin();
+    updateStatsWin();
     updateMainWin();
 }
 
-void interfaceGo(char* viewer) {
-    imgViewer = malloc((strlen(viewer) + 1) * sizeof(char));
-    strcpy(imgViewer, viewer);
+// give a window its place on the screen (creating it if necessary)
+static WINDOW* placeWin(WINDOW* win, int h, int w, int y, int x) {
+    if (win == NULL) return newwin(h, w, y, x);
+    wresize(win, h, w);
+    mvwin(win, y, x);
+    return win;
+}
 
+// (re)arrange all the windows to fit the screen
+static void placeWindows() {
     const int CTRL_PER_LINE = COLS / CONTROL_LEN;
     // http://stackoverflow.com/a/2745086/1223693
     const int HELP_HEIGHT = (NCONTROLS + CTRL_PER_LINE - 1) / CTRL_PER_LINE + 2;
+    // with the built-in viewer, the preview pane takes the right 2/5 or so
+    const int PREVIEW_WIDTH = builtinViewer ? COLS * 2 / 5 : 0;
+    // and the counts go to the left of that, if there's room
+    const int STATS_W = showStats && COLS - PREVIEW_WIDTH >= 2 * STATS_WIDTH
+        ? STATS_WIDTH : 0;
+
+    helpWin = placeWin(helpWin, HELP_HEIGHT, COLS, LINES - HELP_HEIGHT, 0);
+    fileWin = placeWin(fileWin, 3, COLS, 0, 0);
+    mainWin = placeWin(mainWin, LINES - HELP_HEIGHT - 3,
+        COLS - PREVIEW_WIDTH - STATS_W, 3, 0);
+    if (STATS_W) {
+        statsWin = placeWin(statsWin, LINES - HELP_HEIGHT - 3, STATS_W, 3,
+            COLS - PREVIEW_WIDTH - STATS_W);
+    }
+    showStats = STATS_W != 0;
+    if (builtinViewer) {
+        previewWin = placeWin(previewWin, LINES - HELP_HEIGHT - 3,
+            PREVIEW_WIDTH, 3, COLS - PREVIEW_WIDTH);
+    }
+    layoutDirty = 1;
+}
 
-    helpWin = newwin(HELP_HEIGHT, COLS, LINES - HELP_HEIGHT, 0);
+// place and draw everything again (after a resize, say)
+static void redrawAll() {
+    placeWindows();
+    clear();
+    refresh();
     updateHelpWin();
-
-    fileWin = newwin(3, COLS, 0, 0);
     updateFileWin();
+    updateStatsWin();
+    updateMainWin();
+    if (builtinViewer) updateImage();
+    if (gettingInput) {
+        touchwin(inputPopup);
+        wrefresh(inputPopup);
+    }
+}
 
-    mainWin = newwin(LINES - HELP_HEIGHT - 3, COLS, 3, 0);
+int interfaceGo(char* viewer) {
+    builtinViewer = strcmp(viewer, "builtin") == 0;
+    if (!builtinViewer) viewerInit(viewer);
+    prefetchInit();
+    autosaveInit();
+    suggestInit();
+
+    statsRecount();
+    placeWindows();
+    if (builtinViewer) previewInit(previewWin);
+    updateHelpWin();
+    updateFileWin();
+    updateStatsWin();
     updateMainWin();
 
     updateImage();
 
-    char ch;
+    // (only let go of the state while waiting for a key, which is when an
+    // autosave can copy it)
+    lockState();
+    int ch = 0, countBuf = 0;
+    uint64_t keyStart = 0;
     while (1) {
+        // (the last key or poll is done once we're back here, repainting and
+        // all)
+        traceEnd(ch == ERR ? TRACE_POLL : TRACE_KEY, keyStart, ch);
+        unlockState();
         ch = getch();
+        keyStart = traceBegin();
+        lockState();
+
+        if (ch == ERR) {
+            // timed out waiting for a key; see if the preview (or the
+            // thumbnail the suggestions need) is ready yet
+            int waiting = builtinViewer && previewPoll();
+            if (suggestWaiting) {
+                suggestWaiting = suggestPoll();
+                if (!suggestWaiting) updateMainWin();
+                waiting = waiting || suggestWaiting;
+            }
+            if (!waiting) timeout(-1);
+            updateCursor();
+            continue;
+        }
+        if (ch == KEY_RESIZE) {
+            redrawAll();
+            continue;
+        }
+
+        if (!gettingInput && ch >= '0' && ch <= '9' &&
+                (ch != '0' || countBuf != 0)) {
+            // count prefix for the next movement command (e.g. 10j)
+            countBuf = countBuf * 10 + (ch - '0');
+            if (countBuf > MAX_COUNT) countBuf = MAX_COUNT;
+            continue;
+        }
+        int count = countBuf ? countBuf : 1;
+        countBuf = 0;
+        if (ch != 'q' && ch != '\x03') quitUnsaved = 0;
+
         if (gettingInput) {
             if (ch == '\n') {
                 inputCallback(inputBuf);
@@ -226,6 +564,19 @@ void interfaceGo(char* viewer) {
                 free(inputBuf);
 
                 delwin(inputPopup);
+                // repaint whatever the popup was drawn over
+                touchwin(mainWin);
+                wnoutrefresh(mainWin);
+                if (showStats) {
+                    touchwin(statsWin);
+                    wnoutrefresh(statsWin);
+                }
+                if (builtinViewer) {
+                    touchwin(previewWin);
+                    wnoutrefresh(previewWin);
+                }
+                doupdate();
+                updateCursor();
             } else if (ch == '\x07') {  // backspace
                 if (strlen(inputBuf) != 0) {
                     inputBuf[strlen(inputBuf) - 1] = '\0';
@@ -259,104 +610,150 @@ void interfaceGo(char* viewer) {
             case 'r':
                 // TODO checkbox rename
                 break;
-            // TODO eliminate ugly code repetition in j/k and h/l
-            case 'j': {
+            case 'j':
                 // category down
-                int y = CPOS.y, x = CPOS.x,
-                    newY = -1, newX = -1, newIdx = -1,
-                    i;
-                for (i = 0; i < nCpos; ++i) {
-                    if ((cursorPositions[i].y > y) &&
-                            (newIdx == -1 || cursorPositions[i].y < newY ||
-                             (cursorPositions[i].y == newY &&
-                              abs(cursorPositions[i].x - x) < abs(newX - x)))) {
-                        newY = cursorPositions[i].y;
-                        newX = cursorPositions[i].x;
-                        newIdx = i;
-                    }
-                }
-                if (newIdx != -1) cposIdx = newIdx;
-                updateMainWin();
+                cposIdx = layoutMoveRows(cposIdx, count);
+                if (CPOS.categoryIdx != statsFrom) updateStatsWin();
+                updateCursor();
                 break;
-            }
-            case 'k': {
+            case 'k':
                 // category up
-                int y = CPOS.y, x = CPOS.x,
-                    newY = -1, newX = -1, newIdx = -1,
-                    i;
-                for (i = 0; i < nCpos; ++i) {
-                    if ((cursorPositions[i].y < y) &&
-                            (newIdx == -1 || cursorPositions[i].y > newY ||
-                             (cursorPositions[i].y == newY &&
-                              abs(cursorPositions[i].x - x) < abs(newX - x)))) {
-                        newY = cursorPositions[i].y;
-                        newX = cursorPositions[i].x;
-                        newIdx = i;
-                    }
-                }
-                if (newIdx != -1) cposIdx = newIdx;
-                updateMainWin();
+                cposIdx = layoutMoveRows(cposIdx, -count);
+                if (CPOS.categoryIdx != statsFrom) updateStatsWin();
+                updateCursor();
                 break;
-            }
-            case 'h': {
+            case 'h':
                 // checkbox left
-                int y = CPOS.y, x = CPOS.x,
-                    newX = -1, newIdx = -1,
-                    i;
-                for (i = 0; i < nCpos; ++i) {
-                    if (cursorPositions[i].y == y && cursorPositions[i].x < x
-                            && (newIdx == -1 || cursorPositions[i].x > newX)) {
-                        newX = cursorPositions[i].x;
-                        newIdx = i;
-                    }
-                }
-                if (newIdx != -1) cposIdx = newIdx;
-                updateMainWin();
+                cposIdx = layoutMoveCols(cposIdx, -count);
+                updateCursor();
                 break;
-            }
-            case 'l': {
+            case 'l':
                 // checkbox right
-                int y = CPOS.y, x = CPOS.x,
-                    newX = -1, newIdx = -1,
-                    i;
-                for (i = 0; i < nCpos; ++i) {
-                    if (cursorPositions[i].y == y && cursorPositions[i].x > x
-                            && (newIdx == -1 || cursorPositions[i].x < newX)) {
-                        newX = cursorPositions[i].x;
-                        newIdx = i;
-                    }
-                }
-                if (newIdx != -1) cposIdx = newIdx;
-                updateMainWin();
+                cposIdx = layoutMoveCols(cposIdx, count);
+                updateCursor();
                 break;
-            }
             case ' ':
                 // checkbox toggle
                 if (CPOS.chkboxIdx == -1) break;
-                files[fileIdx].data ^= 1 << CPOS.chkboxIdx;
+                if (rangeStart != -1) {
+                    // every file in the range gets what toggling the
+                    // current one would give it
+                    uint64_t* selected = bulkSelectRange(rangeStart, fileIdx);
+                    size_t changed = bulkApply(selected, CPOS.chkboxIdx,
+                        getLabel(fileIdx, CPOS.chkboxIdx) ? BULK_CLEAR
+                        : BULK_SET);
+                    if (changed) autosaveEdited();
+                    snprintf(status, sizeof(status), "%zu files changed",
+                        changed);
+                    free(selected);
+                    rangeStart = -1;
+                    updateFileWin();
+                    updateStatsWin();
+                    updateMainWin();
+                    break;
+                }
+                toggleLabel(fileIdx, CPOS.chkboxIdx);
+                journalLabel(fileIdx, CPOS.chkboxIdx,
+                    getLabel(fileIdx, CPOS.chkboxIdx));
+                statsLabelChanged(fileIdx, CPOS.chkboxIdx,
+                    getLabel(fileIdx, CPOS.chkboxIdx));
+                dedupePropagate(fileIdx, CPOS.chkboxIdx);
+                autosaveEdited();
+                updateStatsWin();
                 updateMainWin();
                 break;
+            case 'v':
+                // start/cancel selecting a range of files
+                rangeStart = rangeStart == -1 ? fileIdx : -1;
+                updateFileWin();
+                break;
+            case 's':
+                // show/hide counts
+                showStats = !showStats;
+                redrawAll();
+                break;
+            case 'm':
+                getInput(cbMatch, "+/-/~ (set/clear/toggle), then a glob or "
+                    "/regex/:");
+                break;
             case 'n':
                 // image next
-                if (fileIdx < nFiles - 1) ++fileIdx;
+                status[0] = '\0';
+                fileIdx = stepFile(count);
                 updateFileWin();
                 updateMainWin();
                 updateImage();
                 break;
             case 'p':
-                // image next
-                if (fileIdx > 0) --fileIdx;
+                // image previous
+                status[0] = '\0';
+                fileIdx = stepFile(-count);
                 updateFileWin();
                 updateMainWin();
                 updateImage();
                 break;
+            case 'u':
+                // next unlabeled image
+                jump(JUMP_UNLABELED, count, "unlabeled files");
+                break;
+            case 'U':
+                jump(JUMP_UNLABELED, -count, "unlabeled files");
+                break;
+            case 'c':
+                // next image with nothing checked in this category
+                jumpCategory(count);
+                break;
+            case 'C':
+                jumpCategory(-count);
+                break;
+            case 'f':
+                getInput(cbFilter, "filter (as for imgctool query; empty to "
+                    "clear):");
+                break;
+            case 'g':
+                // next image matching the filter
+                jumpFilter(count);
+                break;
+            case 'G':
+                jumpFilter(-count);
+                break;
+            case 'y':
+                // accept the suggestions
+                acceptSuggestions();
+                break;
             case 'q':
-            case '\x03': // ctrl+c
-                return;
+            case '\x03': { // ctrl+c
+                unlockState();
+                int err = autosaveQuit();
+                lockState();
+                if (err && !quitUnsaved) {
+                    // don't throw away the edits since the last save without
+                    // asking (autosaving has stopped, but w still saves)
+                    quitUnsaved = 1;
+                    snprintf(status, sizeof(status),
+                        "couldn't save! q again to quit anyway");
+                    redrawAll();
+                    break;
+                }
+                unlockState();
+                prefetchQuit();
+                suggestQuit();
+                if (builtinViewer) previewQuit();
+                else viewerQuit();
+                return err;
+            }
             case 'w':
-            case '\x13': // ctrl+s
-                save();
+            case '\x13': { // ctrl+s
+                // (written by the autosave thread, so this usually doesn't
+                // wait on the disk)
+                unlockState();
+                int err = autosaveNow();
+                lockState();
+                if (err) snprintf(status, sizeof(status), "couldn't save!");
+                else status[0] = '\0';
+                updateFileWin();
                 break;
+            }
         }
     }
 }
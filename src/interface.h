@@ -1,6 +1,7 @@
 #ifndef __INTERFACE_H__
 #define __INTERFACE_H__
 
-void interfaceGo(char* imgViewer);
+// returns nonzero if the labels couldn't be saved on the way out
+int interfaceGo(char* imgViewer);
 
 #endif
@@ -0,0 +1,283 @@
+#include "journal.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ictdata.h"
+
+// Journal format (lives next to the snapshot, as [save file].journal):
+// header: 4 bytes, 0x89 "ICJ", then the size and mtime (seconds and
+//   nanoseconds) of the snapshot it applies to, as 3 little-endian uint64s
+// records: 8 bytes each, a little-endian uint32 file index followed by a
+//   little-endian uint32 of (checkbox index << 1 | new value)
+// Records set a bit rather than toggling it, so replaying one twice is
+// harmless. A journal whose header doesn't match the snapshot is ignored.
+
+static const char JOURNAL_SUFFIX[] = ".journal";
+static const int HEADER_SIZE = 28;
+static const int RECORD_SIZE = 8;
+// compact (write a snapshot) once the journal holds more than this many
+// records, or more bytes than the snapshot's label data, whichever is larger
+static const size_t MIN_COMPACT_RECORDS = 65536;
+
+static unsigned char* pending = NULL;  // RECORD_SIZE bytes per edit
+static size_t nPending = 0, pendingCap = 0;
+static size_t nRecords = 0;   // records already in the journal file
+static size_t snapFiles = 0;  // nFiles when the snapshot was written
+static int invalid = 1;       // the journal can't describe current state
+// all of the above is protected by lock, since saves happen on the autosave
+// thread while the interface keeps adding edits
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char* journalPath(const char* saveFile) {
+    char* path = malloc(strlen(saveFile) + sizeof(JOURNAL_SUFFIX));
+    sprintf(path, "%s%s", saveFile, JOURNAL_SUFFIX);
+    return path;
+}
+
+static void putLE(unsigned char* buf, uint64_t x, int bytes) {
+    int i;
+    for (i = 0; i < bytes; ++i) buf[i] = (x >> (i * 8)) & 0xFF;
+}
+
+static uint64_t getLE(const unsigned char* buf, int bytes) {
+    uint64_t x = 0;
+    int i;
+    for (i = bytes - 1; i >= 0; --i) x = (x << 8) | buf[i];
+    return x;
+}
+
+// fill in the journal header for the current contents of saveFile
+static int makeHeader(const char* saveFile, unsigned char* header) {
+    struct stat st;
+    if (stat(saveFile, &st) != 0) return 1;
+    memcpy(header, "\x89ICJ", 4);
+    putLE(header + 4, st.st_size, 8);
+    putLE(header + 12, st.st_mtim.tv_sec, 8);
+    putLE(header + 20, st.st_mtim.tv_nsec, 8);
+    return 0;
+}
+
+// whether the next save has to be a snapshot (with lock held)
+static int needsSnapshot() {
+    size_t limit = nFiles * ((chkboxCount() + 7) / 8) / RECORD_SIZE;
+    if (limit < MIN_COMPACT_RECORDS) limit = MIN_COMPACT_RECORDS;
+    return invalid || nFiles != snapFiles || nRecords + nPending > limit;
+}
+
+void journalLabel(size_t file, size_t bit, int value) {
+    pthread_mutex_lock(&lock);
+    // once the next save is going to write a snapshot anyway (say, after a
+    // bulk edit of a million files), there's no point keeping edits around
+    if (!invalid && nPending == pendingCap && needsSnapshot()) {
+        invalid = 1;
+        nPending = 0;
+    }
+    if (!invalid) {
+        if (nPending == pendingCap) {
+            pendingCap = pendingCap ? pendingCap * 2 : 256;
+            pending = realloc(pending, pendingCap * RECORD_SIZE);
+        }
+        unsigned char* rec = pending + nPending * RECORD_SIZE;
+        putLE(rec, file, 4);
+        putLE(rec + 4, (bit << 1) | (value != 0), 4);
+        ++nPending;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void journalInvalidate() {
+    pthread_mutex_lock(&lock);
+    invalid = 1;
+    pthread_mutex_unlock(&lock);
+}
+
+int journalNeedsSnapshot() {
+    pthread_mutex_lock(&lock);
+    int needed = needsSnapshot();
+    pthread_mutex_unlock(&lock);
+    return needed;
+}
+
+int journalDirty() {
+    pthread_mutex_lock(&lock);
+    int dirty = nPending != 0 || needsSnapshot();
+    pthread_mutex_unlock(&lock);
+    return dirty;
+}
+
+int journalFlush(const char* saveFile) {
+    // take the pending edits; new ones can pile up while these are written
+    pthread_mutex_lock(&lock);
+    unsigned char* recs = pending;
+    size_t n = nPending, written = nRecords;
+    pending = NULL;
+    nPending = pendingCap = 0;
+    pthread_mutex_unlock(&lock);
+    if (n == 0) {
+        free(recs);
+        return 0;
+    }
+
+    char* path = journalPath(saveFile);
+    FILE* f = fopen(path, written == 0 ? "wb" : "ab");
+    int err = f == NULL;
+    if (!err && written == 0) {
+        unsigned char header[HEADER_SIZE];
+        err = makeHeader(saveFile, header) != 0 ||
+            fwrite(header, 1, HEADER_SIZE, f) != HEADER_SIZE;
+    }
+    if (!err) err = fwrite(recs, RECORD_SIZE, n, f) != n;
+    // (so a crash right after this doesn't lose what was just saved)
+    if (!err) err = fflush(f) != 0 || fdatasync(fileno(f)) != 0;
+    if (f != NULL && fclose(f) != 0) err = 1;
+
+    pthread_mutex_lock(&lock);
+    if (err) {
+        fprintf(stderr, "error writing to file %s\n", path);
+        // part of a record might have made it to the file, so appending more
+        // isn't safe; the next save writes a snapshot instead
+        invalid = 1;
+    } else {
+        nRecords += n;
+    }
+    pthread_mutex_unlock(&lock);
+    free(path);
+    free(recs);
+    return err;
+}
+
+void journalSnapshotTaken() {
+    pthread_mutex_lock(&lock);
+    // these are all in the snapshot
+    nPending = 0;
+    invalid = 0;
+    snapFiles = nFiles;
+    pthread_mutex_unlock(&lock);
+}
+
+void journalReset(const char* saveFile) {
+    char* path = journalPath(saveFile);
+    unlink(path);
+    free(path);
+
+    pthread_mutex_lock(&lock);
+    nRecords = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+// a record of a journal being merged, and where it was in the journal
+struct mergeRecord {
+    size_t file, bit, idx;
+    int value;
+};
+
+static int compareRecords(const void* a, const void* b) {
+    const struct mergeRecord *x = a, *y = b;
+    if (x->file != y->file) return x->file < y->file ? -1 : 1;
+    if (x->bit != y->bit) return x->bit < y->bit ? -1 : 1;
+    return x->idx < y->idx ? -1 : 1;
+}
+
+// apply the records of saveFile's journal, translating file and checkbox
+// indices through fileMap and bitMap (unless they're NULL); when merging, only
+// labels the journal leaves checked are set, and nothing is cleared (so other
+// shards' labels survive); returns how many records were read, or -1 if
+// there's no journal, -2 if it's stale, -3 if it's corrupted
+static ssize_t applyJournal(const char* saveFile, size_t files,
+        const size_t* fileMap, size_t bits, const size_t* bitMap,
+        int merging) {
+    char* path = journalPath(saveFile);
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        // no journal, nothing to do
+        free(path);
+        return -1;
+    }
+
+    unsigned char header[HEADER_SIZE], expected[HEADER_SIZE];
+    if (fread(header, 1, HEADER_SIZE, f) != HEADER_SIZE ||
+            makeHeader(saveFile, expected) != 0 ||
+            memcmp(header, expected, HEADER_SIZE) != 0) {
+        // left over from some other snapshot; the next save will replace it
+        fprintf(stderr, "warning: ignoring stale journal %s\n", path);
+        fclose(f);
+        free(path);
+        return -2;
+    }
+
+    size_t n = 0, cap = 0;
+    struct mergeRecord* recs = NULL;
+    unsigned char rec[RECORD_SIZE];
+    // (a partial record at the end is from a save that was interrupted, and
+    // is silently dropped)
+    while (fread(rec, 1, RECORD_SIZE, f) == RECORD_SIZE) {
+        size_t file = getLE(rec, 4), bit = getLE(rec + 4, 4) >> 1;
+        if (file >= files || bit >= bits) {
+            fprintf(stderr, "journal %s corrupted? (record out of range)\n",
+                path);
+            fclose(f);
+            free(path);
+            free(recs);
+            return -3;
+        }
+        if (merging) {
+            if (n == cap) {
+                cap = cap ? cap * 2 : 1024;
+                recs = realloc(recs, cap * sizeof(struct mergeRecord));
+            }
+            recs[n] = (struct mergeRecord){file, bit, n, rec[4] & 1};
+        } else {
+            setLabel(fileMap ? fileMap[file] : file,
+                bitMap ? bitMap[bit] : bit, rec[4] & 1);
+        }
+        ++n;
+    }
+    fclose(f);
+    free(path);
+
+    if (merging) {
+        // the last record for each label says whether the shard left it
+        // checked
+        qsort(recs, n, sizeof(struct mergeRecord), compareRecords);
+        size_t i;
+        for (i = 0; i < n; ++i) {
+            if (i + 1 < n && recs[i + 1].file == recs[i].file &&
+                    recs[i + 1].bit == recs[i].bit) {
+                continue;
+            }
+            if (!recs[i].value) continue;
+            setLabel(fileMap ? fileMap[recs[i].file] : recs[i].file,
+                bitMap ? bitMap[recs[i].bit] : recs[i].bit, 1);
+        }
+        free(recs);
+    }
+    return n;
+}
+
+int journalReplay(const char* saveFile) {
+    snapFiles = nFiles;
+    ssize_t n = applyJournal(saveFile, nFiles, NULL, chkboxCount(), NULL,
+        0);
+    if (n == -3) return 1;
+    if (n == -2) return 0;  // (so the next save writes a snapshot)
+    invalid = 0;
+    if (n == -1) return 0;
+
+    // make sure later appends line up with whole records
+    nRecords = n;
+    char* path = journalPath(saveFile);
+    truncate(path, HEADER_SIZE + nRecords * RECORD_SIZE);
+    free(path);
+    return 0;
+}
+
+int journalMerge(const char* saveFile, size_t files, const size_t* fileMap,
+        size_t bits, const size_t* bitMap) {
+    return applyJournal(saveFile, files, fileMap, bits, bitMap, 1) == -3;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stddef.h>
+
+// record that checkbox `bit' of file `file' was set to `value'; the edit is
+// kept in memory until the next journalFlush() (or dropped, if there are
+// enough of them that the next save will write a snapshot instead)
+void journalLabel(size_t file, size_t bit, int value);
+
+// record that something other than labels changed (categories, checkboxes or
+// the set of files), which the journal can't express
+void journalInvalidate();
+
+// whether the next save has to write a full snapshot rather than append to
+// the journal (also true once the journal has grown large enough to compact)
+// (with the state lock held, see saverestore.h, since this counts checkboxes)
+int journalNeedsSnapshot();
+
+// whether there's anything to save at all (with the state lock held, too)
+int journalDirty();
+
+// append pending edits to the journal belonging to snapshot saveFile
+// (they can keep coming in from other threads while it's written)
+int journalFlush(const char* saveFile);
+
+// everything up to now was just copied into a snapshot to be written, so the
+// pending edits can go; if writing it fails, call journalInvalidate()
+void journalSnapshotTaken();
+
+// that snapshot was written to saveFile, so start an empty journal
+void journalReset(const char* saveFile);
+
+// apply the journal belonging to saveFile on top of the just-restored snapshot
+int journalReplay(const char* saveFile);
+
+// apply the journal belonging to saveFile (which has `files' files and `bits'
+// checkboxes) on top of the current labels, which have file i and checkbox b
+// of saveFile at fileMap[i] and bitMap[b] (see restoreMerge()); like the
+// merge itself, this only ever checks boxes, never clears them
+int journalMerge(const char* saveFile, size_t files, const size_t* fileMap,
+    size_t bits, const size_t* bitMap);
+
+#endif
@@ -0,0 +1,91 @@
+#include "jump.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ictdata.h"
+#include "stats.h"
+#include "query.h"
+#include "dedupe.h"
+
+// words of the bitmap built at a time: a jump usually stops close by, so
+// there's no point building the whole thing, but a query is evaluated a few
+// thousand files at a time anyway
+static const size_t BLOCK_WORDS = 64;
+
+// build words first .. first + n - 1 of the bitmap of files to stop at (bits
+// past the last file can be anything)
+static void fill(uint64_t* block, size_t first, size_t n, enum jumpKind kind,
+        size_t categoryIdx) {
+    size_t w;
+    if (kind == JUMP_UNLABELED) {
+        for (w = 0; w < n; ++w) block[w] = ~labeledFiles[first + w];
+    } else if (kind == JUMP_CATEGORY) {
+        // OR the category's columns together, then look for the gaps
+        size_t bit = categoryFirstBit(categoryIdx),
+            end = bit + categories[categoryIdx].nChkboxes;
+        memset(block, 0, n * sizeof(uint64_t));
+        for (; bit < end; ++bit) {
+            const uint64_t* col = labelColumns[bit] + first;
+            for (w = 0; w < n; ++w) block[w] |= col[w];
+        }
+        for (w = 0; w < n; ++w) block[w] = ~block[w];
+    } else {
+        queryEvaluate(block, first, n);
+    }
+}
+
+ssize_t jumpFind(enum jumpKind kind, size_t categoryIdx, size_t from,
+        int step) {
+    size_t words = (nFiles + 63) >> 6, lo, hi, w;
+    uint64_t* block = malloc(BLOCK_WORDS * sizeof(uint64_t));
+    ssize_t found = -1;
+
+    if (step > 0 && from + 1 < nFiles) {
+        // files from + 1 onwards, lowest bit first
+        size_t start = from + 1;
+        for (lo = start >> 6; lo < words && found == -1; lo += BLOCK_WORDS) {
+            size_t n = words - lo < BLOCK_WORDS ? words - lo : BLOCK_WORDS;
+            fill(block, lo, n, kind, categoryIdx);
+            for (w = lo; w < lo + n && found == -1; ++w) {
+                uint64_t x = block[w - lo];
+                if (w == start >> 6) x &= ~(uint64_t)0 << (start & 63);
+                if (w == words - 1 && (nFiles & 63) != 0) {
+                    x &= ((uint64_t)1 << (nFiles & 63)) - 1;
+                }
+                for (; x != 0; x &= x - 1) {
+                    size_t f = (w << 6) | __builtin_ctzll(x);
+                    if (dupFirst(f) == f) {
+                        found = f;
+                        break;
+                    }
+                }
+            }
+        }
+    } else if (step < 0 && from > 0 && from <= nFiles) {
+        // files from - 1 down to 0, highest bit first
+        size_t end = from - 1;
+        for (hi = end >> 6; found == -1; hi = lo - 1) {
+            lo = hi + 1 > BLOCK_WORDS ? hi + 1 - BLOCK_WORDS : 0;
+            fill(block, lo, hi - lo + 1, kind, categoryIdx);
+            for (w = hi + 1; w-- > lo && found == -1;) {
+                uint64_t x = block[w - lo];
+                if (w == end >> 6) x &= ~(uint64_t)0 >> (63 - (end & 63));
+                while (x != 0) {
+                    size_t i = 63 - __builtin_clzll(x),
+                        f = (w << 6) | i;
+                    if (dupFirst(f) == f) {
+                        found = f;
+                        break;
+                    }
+                    x &= ~((uint64_t)1 << i);
+                }
+            }
+            if (lo == 0) break;
+        }
+    }
+
+    free(block);
+    return found;
+}
@@ -0,0 +1,27 @@
+#ifndef __JUMP_H__
+#define __JUMP_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// finding the next file that still needs work, for the interface's jump
+// commands
+// the files a jump can stop at are a bitmap built a block of words at a time
+// (from a summary kept by stats.h, the label columns or a query) and
+// searched a word at a time, so even a jump past a million files is just a
+// few thousand word operations
+
+enum jumpKind {
+    JUMP_UNLABELED,  // files with no checkbox checked
+    JUMP_CATEGORY,   // files with no checkbox of category categoryIdx checked
+    JUMP_FILTER      // files matching the expression queryCompile() was last
+                     // given (see query.h)
+};
+
+// the first file after `from' (before it, if step is -1) that a jump of the
+// given kind stops at, or -1 if there isn't one; copies of earlier files
+// (see dedupe.h) are skipped, like n/p do
+ssize_t jumpFind(enum jumpKind kind, size_t categoryIdx, size_t from,
+    int step);
+
+#endif
@@ -0,0 +1,96 @@
+#include "layout.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ictdata.h"
+
+struct cpos* cursorPositions = NULL;
+int nCpos = 0;
+int* categoryRows = NULL;
+int* rowStarts = NULL;
+int nRows = 0;
+
+static void setCpos(struct cpos* c, int y, int x, int categoryIdx,
+        int chkboxIdx, int relChkboxIdx) {
+    // positions are generated top to bottom, so a new y is a new row
+    if (c == cursorPositions || c[-1].y != y) {
+        rowStarts[nRows++] = c - cursorPositions;
+    }
+
+    c->y = y;
+    c->row = nRows - 1;
+    c->x = x;
+    c->categoryIdx = categoryIdx;
+    c->chkboxIdx = chkboxIdx;
+    c->relChkboxIdx = relChkboxIdx;
+}
+
+void layoutBuild(int width) {
+    // one position per checkbox, plus one for each empty category
+    size_t i, j, n = 0;
+    for (i = 0; i < nCategories; ++i) {
+        n += categories[i].nChkboxes == 0 ? 1 : categories[i].nChkboxes;
+    }
+    if (n == 0) n = 1;
+    cursorPositions = realloc(cursorPositions, n * sizeof(struct cpos));
+    categoryRows = realloc(categoryRows, (nCategories + 1) * sizeof(int));
+    // there can't be more rows than positions
+    rowStarts = realloc(rowStarts, (n + 1) * sizeof(int));
+    nCpos = 0;
+    nRows = 0;
+
+    int y = 1, chkboxIdx = 0;
+    for (i = 0; i < nCategories; ++i) {
+        categoryRows[i] = y;
+        int x = 1 + strlen(categories[i].name);
+        for (j = 0; j < categories[i].nChkboxes; ++j) {
+            int len = 6 + strlen(categories[i].chkboxes[j]);  // "  [x] name"
+            if (x + len > width - 1) {
+                // wrap
+                ++y;
+                x = 1;
+            }
+            setCpos(&cursorPositions[nCpos++], y, x + 3, i, chkboxIdx++, j);
+            x += len;
+        }
+        if (categories[i].nChkboxes == 0) {
+            // allow the cursor to go to (y, 1) (start of name)
+            setCpos(&cursorPositions[nCpos++], y, 1, i, -1, -1);
+        }
+        ++y;
+    }
+    if (nCategories == 0) {
+        // fine, the cursor can go to (1, 1)
+        setCpos(&cursorPositions[nCpos++], 1, 1, -1, -1, -1);
+    }
+    rowStarts[nRows] = nCpos;
+}
+
+int layoutMoveRows(int idx, int n) {
+    int row = cursorPositions[idx].row + n, x = cursorPositions[idx].x;
+    if (row < 0) row = 0;
+    if (row >= nRows) row = nRows - 1;
+
+    // first position on the row at or right of x...
+    int lo = rowStarts[row], hi = rowStarts[row + 1] - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cursorPositions[mid].x < x) lo = mid + 1;
+        else hi = mid;
+    }
+    // ...unless the one before it is at least as close
+    if (lo > rowStarts[row] &&
+            x - cursorPositions[lo - 1].x <= abs(cursorPositions[lo].x - x)) {
+        --lo;
+    }
+    return lo;
+}
+
+int layoutMoveCols(int idx, int n) {
+    int row = cursorPositions[idx].row;
+    idx += n;
+    if (idx < rowStarts[row]) idx = rowStarts[row];
+    if (idx >= rowStarts[row + 1]) idx = rowStarts[row + 1] - 1;
+    return idx;
+}
@@ -0,0 +1,40 @@
+#ifndef __LAYOUT_H__
+#define __LAYOUT_H__
+
+// where everything goes in the categories window: each category name starts a
+// new line at x = 1, followed by its checkboxes ("  [x] name"), wrapping onto
+// more lines if they don't fit
+// this only depends on the categories and the window width, so it's only
+// recomputed (with layoutBuild()) when one of those changes
+
+// places the cursor can be, in order of (y, x)
+extern struct cpos {
+    int y;
+    int row;           // index into rowStarts
+    int x;             // on the checkbox's [ ], or 1 for an empty category
+    int categoryIdx;   // -1 if there are no categories at all
+    int chkboxIdx;     // counting across all categories; -1 if none
+    int relChkboxIdx;  // within its category; -1 if none
+}* cursorPositions;
+extern int nCpos;
+
+// line each category's name is on
+extern int* categoryRows;
+
+// the cursor positions on row r are rowStarts[r] .. rowStarts[r + 1] - 1
+// (every line of the layout has at least one)
+extern int* rowStarts;
+extern int nRows;
+
+// lay out the current categories for a window `width' columns wide
+void layoutBuild(int width);
+
+// cursor position `n' rows below (above, if negative) position idx, as close
+// as possible horizontally; stops at the first/last row
+int layoutMoveRows(int idx, int n);
+
+// cursor position `n' places right (left, if negative) of position idx on the
+// same row; stops at either end of the row
+int layoutMoveCols(int idx, int n);
+
+#endif
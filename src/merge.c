@@ -0,0 +1,53 @@
+#include "merge.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ictdata.h"
+#include "saverestore.h"
+#include "journal.h"
+
+// whether argv[i] is one of the files kept next to another of the arguments
+// (its lock or journal, say), which a glob like .imgctool.shard-* picks up too
+static int companion(int argc, char* argv[], int i) {
+    int j;
+    for (j = 1; j < argc; ++j) {
+        size_t len = strlen(argv[j]);
+        if (j != i && strncmp(argv[i], argv[j], len) == 0 &&
+                argv[i][len] == '.') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int merge(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: imgctool merge SHARD...\n");
+        return 1;
+    }
+
+    // (so two merges, or a merge and someone labeling, can't both write the
+    // save file and lose one another's work)
+    if (lockSaveFile() != 0) {
+        fprintf(stderr, "fatal: %s is in use by another imgctool, "
+            "aborting\n", saveFileName());
+        return 1;
+    }
+    if (restore() != 0) return 1;
+
+    size_t oldFiles = nFiles, oldChkboxes = chkboxCount();
+    int i, nMerged = 0;
+    for (i = 1; i < argc; ++i) {
+        if (companion(argc, argv, i)) continue;
+        if (restoreMerge(argv[i]) != 0) return 1;
+        ++nMerged;
+    }
+    printf("Merged %d file%s into %s: %zu files (%zu new), %zu checkboxes "
+        "(%zu new).\n", nMerged, nMerged == 1 ? "" : "s", saveFileName(),
+        nFiles, nFiles - oldFiles, chkboxCount(),
+        chkboxCount() - oldChkboxes);
+
+    journalInvalidate();
+    return save();
+}
@@ -0,0 +1,11 @@
+#ifndef __MERGE_H__
+#define __MERGE_H__
+
+// `imgctool merge SHARD...': read the given save files (usually shards
+// written by `imgctool -S', see README) into the save file, matching up
+// categories, checkboxes and files by name; a checkbox checked in any of them
+// ends up checked
+// argv[0] is "merge"; returns the exit status
+int merge(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,194 @@
+#include "order.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+#include "ictdata.h"
+#include "dedupe.h"
+#include "journal.h"
+
+size_t* fileAdded = NULL;
+size_t nFileAdded = 0;
+
+static const char* KEY_NAMES[] = { "added", "dir", "inode", "extent" };
+
+size_t orderAdded(size_t file) {
+    return file < nFileAdded ? fileAdded[file] : file;
+}
+
+int orderParse(const char* name, enum orderKey* key) {
+    size_t i;
+    for (i = 0; i < sizeof(KEY_NAMES) / sizeof(char*); ++i) {
+        if (strcmp(name, KEY_NAMES[i]) == 0) {
+            *key = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static enum orderKey sortBy;
+
+// where each file is on disk, for inode and extent: its device, then either
+// kind 0 and the physical offset of its first extent, or kind 1 and its inode
+// (so files with no extent to go by come after the others on the same
+// device); all UINT64_MAX if it can't be opened
+static struct location {
+    uint64_t dev, kind, pos;
+}* locations = NULL;
+
+static void locateFile(size_t file) {
+    struct location* loc = &locations[file];
+    struct stat st;
+    int fd = -1;
+    if (sortBy == ORDER_EXTENT) {
+        fd = open(fileName(file), O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || fstat(fd, &st) != 0) {
+            if (fd != -1) close(fd);
+            loc->dev = loc->kind = loc->pos = UINT64_MAX;
+            return;
+        }
+    } else if (stat(fileName(file), &st) != 0) {
+        loc->dev = loc->kind = loc->pos = UINT64_MAX;
+        return;
+    }
+    loc->dev = st.st_dev;
+    loc->kind = 1;
+    loc->pos = st.st_ino;
+    if (fd == -1) return;
+
+#ifdef FS_IOC_FIEMAP
+    // just the first extent: where reading the file starts
+    uint64_t buf[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / 8
+        + 1];
+    struct fiemap* map = (struct fiemap*)buf;
+    memset(buf, 0, sizeof(buf));
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents == 1) {
+        loc->kind = 0;
+        loc->pos = map->fm_extents[0].fe_physical;
+    }
+#endif
+    close(fd);
+}
+
+// the threads take files in chunks of this many
+static const size_t CHUNK = 64;
+static size_t nextChunk = 0;  // (atomic)
+
+static void* worker(void* arg) {
+    size_t start, i;
+    while ((start = __atomic_fetch_add(&nextChunk, CHUNK, __ATOMIC_RELAXED))
+            < nFiles) {
+        for (i = start; i < start + CHUNK && i < nFiles; ++i) locateFile(i);
+    }
+    return NULL;
+}
+
+static int compareFiles(const void* a, const void* b) {
+    size_t x = *(const size_t*)a, y = *(const size_t*)b;
+    int c = 0;
+    if (sortBy == ORDER_DIR) {
+        const char *dx = fileDir(x), *dy = fileDir(y);
+        if (dx != dy) c = strcmp(dx, dy);
+        if (c == 0) c = strcmp(fileBaseName(x), fileBaseName(y));
+    } else {
+        const struct location *lx = &locations[x], *ly = &locations[y];
+        if (lx->dev != ly->dev) c = lx->dev < ly->dev ? -1 : 1;
+        else if (lx->kind != ly->kind) c = lx->kind < ly->kind ? -1 : 1;
+        else if (lx->pos != ly->pos) c = lx->pos < ly->pos ? -1 : 1;
+    }
+    if (c != 0) return c;
+    // (ties stay in the order they were in)
+    return x < y ? -1 : 1;
+}
+
+void orderFiles(enum orderKey key) {
+    size_t i, nUnreadable = 0;
+    sortBy = key;
+
+    if (key == ORDER_INODE || key == ORDER_EXTENT) {
+        locations = malloc((nFiles + 1) * sizeof(struct location));
+        char* threadsEnv = getenv("IMG_THREADS");
+        long nThreads = threadsEnv != NULL ? atol(threadsEnv) :
+            sysconf(_SC_NPROCESSORS_ONLN);
+        if (nThreads < 1) nThreads = 1;
+        pthread_t* threads = malloc(nThreads * sizeof(pthread_t));
+        nextChunk = 0;
+        for (i = 0; i < nThreads; ++i) {
+            pthread_create(&threads[i], NULL, worker, NULL);
+        }
+        for (i = 0; i < nThreads; ++i) pthread_join(threads[i], NULL);
+        free(threads);
+        for (i = 0; i < nFiles; ++i) {
+            nUnreadable += locations[i].dev == UINT64_MAX;
+        }
+    }
+
+    size_t* order = malloc((nFiles + 1) * sizeof(size_t));
+    if (key == ORDER_ADDED) {
+        // (no need to sort for that)
+        for (i = 0; i < nFiles; ++i) order[orderAdded(i)] = i;
+    } else {
+        for (i = 0; i < nFiles; ++i) order[i] = i;
+        qsort(order, nFiles, sizeof(size_t), compareFiles);
+    }
+    free(locations);
+    locations = NULL;
+
+    size_t nMoved = 0;
+    for (i = 0; i < nFiles; ++i) nMoved += order[i] != i;
+    if (nMoved) {
+        permuteFiles(order);
+
+        // everything else that's indexed by file
+        if (fileStamps != NULL) {
+            struct fileStamp* stamps = malloc(
+                (nFiles + 1) * sizeof(struct fileStamp));
+            for (i = 0; i < nFiles; ++i) {
+                if (order[i] < nFileStamps) stamps[i] = fileStamps[order[i]];
+                else stamps[i].size = UINT64_MAX;
+            }
+            free(fileStamps);
+            fileStamps = stamps;
+            nFileStamps = nFiles;
+        }
+        size_t* added = malloc((nFiles + 1) * sizeof(size_t));
+        int inOrder = 1;
+        for (i = 0; i < nFiles; ++i) {
+            added[i] = orderAdded(order[i]);
+            if (added[i] != i) inOrder = 0;
+        }
+        free(fileAdded);
+        if (inOrder) {
+            // (back where they started, so there's nothing to remember)
+            free(added);
+            added = NULL;
+        }
+        fileAdded = added;
+        nFileAdded = inOrder ? 0 : nFiles;
+
+        // the journal refers to files by index
+        journalInvalidate();
+    }
+    free(order);
+
+    printf("Sorted %zu files by %s; %zu moved", nFiles, KEY_NAMES[key],
+        nMoved);
+    if (nUnreadable) {
+        printf(" (%zu couldn't be opened, and went last)", nUnreadable);
+    }
+    printf(".\n");
+}
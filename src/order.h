@@ -0,0 +1,40 @@
+#ifndef __ORDER_H__
+#define __ORDER_H__
+
+#include <stddef.h>
+
+// putting files[] in an order that's quicker to read the images in than the
+// order they were added in, which is usually random as far as the disk is
+// concerned
+// files[] is the order they're shown in; the order they were added in is
+// kept alongside (and in the save file, see saverestore.c), so it can always
+// be gone back to
+
+enum orderKey {
+    ORDER_ADDED,  // back to the order they were added in
+    ORDER_DIR,    // by directory, then name
+    ORDER_INODE,  // by device and inode number
+    ORDER_EXTENT  // by where their data starts on disk (FIEMAP), falling back
+                  // to the inode for files that don't say
+};
+
+// where each file was added (counting from 0), for the first nFileAdded
+// files; NULL if files[] hasn't been reordered, and files past nFileAdded
+// (added since) were added in the order they're in
+extern size_t* fileAdded;
+extern size_t nFileAdded;
+
+// where a file was added
+size_t orderAdded(size_t file);
+
+// the key called name ("added", "dir", "inode" or "extent"); returns -1 if
+// there isn't one
+int orderParse(const char* name, enum orderKey* key);
+
+// sort files[] by key, moving everything indexed by file along with it (so
+// call this before dedupeFiles())
+// inode and extent look at every file (spread over IMG_THREADS threads);
+// files that can't be opened go last
+void orderFiles(enum orderKey key);
+
+#endif
@@ -0,0 +1,164 @@
+#define _GNU_SOURCE  // O_NOATIME
+#include "prefetch.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ictdata.h"
+
+static const size_t DEFAULT_WINDOW = 4;
+static const size_t DEFAULT_BYTES = 64 << 20;
+
+static size_t window = 0, maxBytes = 0;
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+// all protected by lock
+static size_t hint = 0;
+static int hintChanged = 0, quitting = 0, running = 0;
+
+// the files the last pass already asked for (in order), and how many bytes of
+// each; a pass only touches ones that weren't in here, since on network storage
+// even the open() and fstat() aren't free
+// the bytes of the ones still ahead count against IMG_PREFETCH_BYTES, so it
+// caps how much is requested at once, not just per move; files the labeler has
+// passed (or moved away from) drop out and free up their share
+struct request {
+    size_t file, bytes;
+};
+static struct request* done = NULL;
+static size_t nDone = 0;
+
+static int newHint() {
+    pthread_mutex_lock(&lock);
+    int changed = hintChanged || quitting;
+    pthread_mutex_unlock(&lock);
+    return changed;
+}
+
+// the last pass's request for file, or NULL if it didn't ask for it
+static const struct request* alreadyDone(size_t file) {
+    size_t i;
+    for (i = 0; i < nDone; ++i) if (done[i].file == file) return &done[i];
+    return NULL;
+}
+
+// returns how many bytes were requested
+static size_t prefetchFile(size_t file, size_t budget) {
+    int fd = open(fileName(file), O_RDONLY | O_NOATIME);
+    if (fd == -1) fd = open(fileName(file), O_RDONLY);  // (not our file)
+    if (fd == -1) return 0;
+
+    struct stat st;
+    size_t len = 0;
+    if (fstat(fd, &st) == 0) {
+        len = (size_t)st.st_size < budget ? (size_t)st.st_size : budget;
+        posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+    return len;
+}
+
+static void* prefetchThread(void* arg) {
+    size_t* todo = malloc((window + 1) * sizeof(size_t));
+    struct request* doneNext = malloc((window + 1) * sizeof(struct request));
+    done = malloc((window + 1) * sizeof(struct request));
+
+    while (1) {
+        pthread_mutex_lock(&lock);
+        while (!hintChanged && !quitting) pthread_cond_wait(&wake, &lock);
+        if (quitting) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        size_t file = hint;
+        hintChanged = 0;
+        pthread_mutex_unlock(&lock);
+
+        // nearest first: the next `window' files, then the previous one
+        size_t nTodo = 0, i, bytes = 0;
+        for (i = 1; i <= window && file + i < nFiles; ++i) {
+            todo[nTodo++] = file + i;
+        }
+        if (file > 0) todo[nTodo++] = file - 1;
+
+        // what's still outstanding from the last pass
+        for (i = 0; i < nTodo; ++i) {
+            const struct request* req = alreadyDone(todo[i]);
+            if (req != NULL) bytes += req->bytes;
+        }
+
+        size_t nDoneNext = 0;
+        int interrupted = 0;
+        for (i = 0; i < nTodo; ++i) {
+            const struct request* req = alreadyDone(todo[i]);
+            if (req != NULL) {
+                doneNext[nDoneNext++] = *req;
+                continue;
+            }
+            // stop early if the labeler has already moved on (but keep
+            // track of the rest that were already asked for)
+            if (interrupted || bytes >= maxBytes || (interrupted = newHint())) {
+                continue;
+            }
+            size_t len = prefetchFile(todo[i], maxBytes - bytes);
+            bytes += len;
+            doneNext[nDoneNext].file = todo[i];
+            doneNext[nDoneNext++].bytes = len;
+        }
+
+        struct request* tmp = done;
+        done = doneNext;
+        doneNext = tmp;
+        nDone = nDoneNext;
+    }
+
+    free(todo);
+    free(doneNext);
+    free(done);
+    return NULL;
+}
+
+static size_t envSize(const char* name, size_t def) {
+    char* val = getenv(name);
+    if (val == NULL || *val == '\0') return def;
+    char* end;
+    size_t n = strtoull(val, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': n <<= 10; break;
+        case 'm': case 'M': n <<= 20; break;
+        case 'g': case 'G': n <<= 30; break;
+    }
+    return n;
+}
+
+void prefetchInit() {
+    window = envSize("IMG_PREFETCH", DEFAULT_WINDOW);
+    maxBytes = envSize("IMG_PREFETCH_BYTES", DEFAULT_BYTES);
+    if (window == 0 || maxBytes == 0) return;
+
+    if (pthread_create(&thread, NULL, prefetchThread, NULL) == 0) running = 1;
+}
+
+void prefetchHint(size_t file) {
+    if (!running) return;
+    pthread_mutex_lock(&lock);
+    hint = file;
+    hintChanged = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+void prefetchQuit() {
+    if (!running) return;
+    pthread_mutex_lock(&lock);
+    quitting = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    running = 0;
+}
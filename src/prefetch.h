@@ -0,0 +1,19 @@
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <stddef.h>
+
+// start the prefetch thread, which asks the kernel to start reading the next
+// few files (and the previous one) while the current one is being labeled
+// the environment variables IMG_PREFETCH (number of files ahead, default 4,
+// 0 to disable) and IMG_PREFETCH_BYTES (cap on bytes requested and not yet
+// passed, default 64M) configure it
+void prefetchInit();
+
+// the file being shown is now `file'
+void prefetchHint(size_t file);
+
+// stop the prefetch thread
+void prefetchQuit();
+
+#endif
@@ -0,0 +1,247 @@
+#include "preview.h"
+
+#include <langinfo.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ictdata.h"
+#include "image.h"
+
+static const size_t DEFAULT_CACHE = 32;
+static const char RAMP[] = " .:-=+*#%@";
+
+// a rendered image: 2 bytes per cell, the colors (indices into the 6x6x6
+// xterm color cube) of the top and bottom half of the cell
+static struct frame {
+    size_t file;
+    int paneW, paneH;  // size of the pane it was rendered for
+    int w, h;          // size in cells
+    unsigned char* cells;
+    unsigned long lastUse;
+    int failed;        // couldn't decode the image
+}* cache = NULL;
+static size_t cacheSize = 0, nCached = 0;
+static unsigned long useClock = 0;
+
+static WINDOW* win;
+static int useColor = 0;
+static short* pairs = NULL;  // pairs[top * 216 + bottom], 0 if not set up yet
+static int nextPair = 1, maxPair = 0;
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+// all protected by lock (along with the cache)
+static size_t shown = 0;
+static int paneW = 0, paneH = 0, quitting = 0, running = 0, pending = 0;
+
+static int cubeLevel(unsigned char v) {
+    // nearest of the cube's levels 0, 95, 135, 175, 215, 255
+    return v < 48 ? 0 : v < 115 ? 1 : (v - 35) / 40;
+}
+
+static struct frame* findFrame(size_t file) {
+    size_t i;
+    for (i = 0; i < nCached; ++i) {
+        if (cache[i].file == file && cache[i].paneW == paneW &&
+                cache[i].paneH == paneH) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+// decode and scale a file to fit a paneW by paneH pane
+static void render(size_t file, int pw, int ph, struct frame* fr) {
+    struct image img, small;
+    fr->file = file;
+    fr->paneW = pw;
+    fr->paneH = ph;
+    fr->cells = NULL;
+    fr->failed = imageLoad(fileName(file), &img) != 0;
+    if (fr->failed) return;
+
+    // every cell is two (roughly square) pixels stacked vertically
+    double sx = (double)pw / img.w, sy = (double)ph * 2 / img.h,
+        s = sx < sy ? sx : sy;
+    fr->w = img.w * s;
+    fr->h = (img.h * s + 1) / 2;
+    if (fr->w < 1) fr->w = 1;
+    if (fr->h < 1) fr->h = 1;
+    imageScale(&img, &small, fr->w, fr->h * 2);
+    imageFree(&img);
+
+    fr->cells = malloc((size_t)fr->w * fr->h * 2);
+    int x, y;
+    for (y = 0; y < fr->h * 2; ++y) {
+        for (x = 0; x < fr->w; ++x) {
+            unsigned char* p = small.rgb + ((size_t)y * fr->w + x) * 3;
+            fr->cells[((size_t)(y / 2) * fr->w + x) * 2 + y % 2] =
+                cubeLevel(p[0]) * 36 + cubeLevel(p[1]) * 6 + cubeLevel(p[2]);
+        }
+    }
+    imageFree(&small);
+}
+
+static void* renderThread(void* arg) {
+    pthread_mutex_lock(&lock);
+    while (!quitting) {
+        // the shown file first, then its neighbors (so flipping is instant)
+        size_t want[3] = {shown, shown + 1, shown - 1}, file = (size_t)-1;
+        int i;
+        for (i = 0; i < 3; ++i) {
+            if (want[i] < nFiles && findFrame(want[i]) == NULL) {
+                file = want[i];
+                break;
+            }
+        }
+        if (file == (size_t)-1) {
+            pthread_cond_wait(&wake, &lock);
+            continue;
+        }
+
+        int pw = paneW, ph = paneH;
+        pthread_mutex_unlock(&lock);
+        struct frame fr;
+        render(file, pw, ph, &fr);
+        pthread_mutex_lock(&lock);
+
+        // evict the least recently used frame if the cache is full
+        struct frame* slot;
+        if (nCached < cacheSize) {
+            slot = &cache[nCached++];
+        } else {
+            slot = &cache[0];
+            size_t j;
+            for (j = 1; j < nCached; ++j) {
+                if (cache[j].lastUse < slot->lastUse) slot = &cache[j];
+            }
+            free(slot->cells);
+        }
+        *slot = fr;
+        slot->lastUse = ++useClock;
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static short pairFor(int top, int bottom) {
+    short* p = &pairs[top * 216 + bottom];
+    if (*p == 0 && nextPair <= maxPair) {
+        init_pair(nextPair, 16 + top, 16 + bottom);
+        *p = nextPair++;
+    }
+    return *p;
+}
+
+// brightness (0-255) of a cube color
+static int cubeGray(int c) {
+    static const int LEVELS[] = {0, 95, 135, 175, 215, 255};
+    return (LEVELS[c / 36] * 3 + LEVELS[c / 6 % 6] * 6 + LEVELS[c % 6]) / 10;
+}
+
+// draw a frame (called with lock held)
+static void draw(struct frame* fr) {
+    werase(win);
+    box(win, 0, 0);
+    mvwprintw(win, 0, 2, "preview");
+
+    if (fr->failed) {
+        mvwprintw(win, 1, 1, "(can't decode image)");
+    } else {
+        int x0 = 1 + (paneW - fr->w) / 2, y0 = 1 + (paneH - fr->h) / 2, x, y;
+        // start over with color pairs if this frame might not fit
+        if (useColor && nextPair + fr->w * fr->h > maxPair) {
+            memset(pairs, 0, 216 * 216 * sizeof(short));
+            nextPair = 1;
+        }
+        for (y = 0; y < fr->h; ++y) {
+            wmove(win, y0 + y, x0);
+            for (x = 0; x < fr->w; ++x) {
+                unsigned char* c = fr->cells + ((size_t)y * fr->w + x) * 2;
+                short pair = useColor ? pairFor(c[0], c[1]) : 0;
+                if (pair != 0) {
+                    wcolor_set(win, pair, NULL);
+                    waddstr(win, "\xe2\x96\x80");  // U+2580 upper half block
+                } else {
+                    wcolor_set(win, 0, NULL);
+                    waddch(win, RAMP[(cubeGray(c[0]) + cubeGray(c[1])) / 2 *
+                        (sizeof(RAMP) - 1) / 256]);
+                }
+            }
+        }
+        wcolor_set(win, 0, NULL);
+    }
+    fr->lastUse = ++useClock;
+    wrefresh(win);
+}
+
+void previewInit(WINDOW* w) {
+    win = w;
+    paneW = getmaxx(win) - 2;
+    paneH = getmaxy(win) - 2;
+
+    char* size = getenv("IMG_PREVIEW_CACHE");
+    cacheSize = size != NULL && atoi(size) > 0 ? atoi(size) : DEFAULT_CACHE;
+    cache = malloc(cacheSize * sizeof(struct frame));
+
+    if (has_colors() && strcmp(nl_langinfo(CODESET), "UTF-8") == 0) {
+        start_color();
+        use_default_colors();
+        if (COLORS >= 256) {
+            useColor = 1;
+            maxPair = COLOR_PAIRS - 1 > 32767 ? 32767 : COLOR_PAIRS - 1;
+            pairs = calloc(216 * 216, sizeof(short));
+        }
+    }
+
+    if (pthread_create(&thread, NULL, renderThread, NULL) == 0) running = 1;
+}
+
+void previewShow(size_t file) {
+    pthread_mutex_lock(&lock);
+    shown = file;
+    // (the pane may have been resized)
+    paneW = getmaxx(win) - 2;
+    paneH = getmaxy(win) - 2;
+
+    struct frame* fr = findFrame(file);
+    if (fr != NULL) {
+        draw(fr);
+        pending = 0;
+    } else {
+        werase(win);
+        box(win, 0, 0);
+        mvwprintw(win, 0, 2, "preview");
+        mvwprintw(win, 1, 1, "loading...");
+        wrefresh(win);
+        pending = running;
+    }
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+int previewPoll() {
+    pthread_mutex_lock(&lock);
+    if (pending) {
+        struct frame* fr = findFrame(shown);
+        if (fr != NULL) {
+            draw(fr);
+            pending = 0;
+        }
+    }
+    int stillPending = pending;
+    pthread_mutex_unlock(&lock);
+    return stillPending;
+}
+
+void previewQuit() {
+    if (!running) return;
+    pthread_mutex_lock(&lock);
+    quitting = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    running = 0;
+}
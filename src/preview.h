@@ -0,0 +1,25 @@
+#ifndef __PREVIEW_H__
+#define __PREVIEW_H__
+
+#include <stddef.h>
+#include <ncurses.h>
+
+// use win (a boxed window) as the built-in image preview pane, and start the
+// thread that decodes and scales images for it
+// images are drawn with colored half-block characters on UTF-8 terminals with
+// 256 colors, and with an ASCII brightness ramp otherwise; the last
+// IMG_PREVIEW_CACHE (default 32) rendered frames are kept around
+void previewInit(WINDOW* win);
+
+// show a file in the preview pane (right away if it's cached, otherwise as
+// soon as previewPoll() notices it's been rendered)
+void previewShow(size_t file);
+
+// draw the current file if it was rendered since the last call; returns
+// whether it's still being rendered (so the caller should poll again soon)
+int previewPoll();
+
+// stop the render thread
+void previewQuit();
+
+#endif
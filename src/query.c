@@ -0,0 +1,469 @@
+#include "query.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "ictdata.h"
+#include "saverestore.h"
+#include "stats.h"
+
+// files are matched CHUNK_WORDS * 64 at a time: for every checkbox in the
+// expression, its bits for the chunk are gathered into a vector of words,
+// and the expression is evaluated with whole-word AND/OR/ANDNOT over those
+// vectors, so memory use doesn't depend on the number of files
+static const size_t CHUNK_WORDS = 64;
+
+// the expression, compiled to postfix
+enum opType { OP_LABEL, OP_NOT, OP_AND, OP_OR, OP_ANDNOT };
+static struct op {
+    enum opType type;
+    size_t bit;  // for OP_LABEL
+}* ops = NULL;
+static size_t nOps = 0;
+
+// room for every vector the expression could push at once (see evaluate())
+static uint64_t* stack = NULL;
+
+static const char* input;  // what's left of the expression being parsed
+
+// what was wrong with the expression, if it didn't compile
+static char error[128];
+
+static void parseError(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(error, sizeof(error), fmt, ap);
+    va_end(ap);
+}
+
+static void emit(enum opType type, size_t bit) {
+    // a & !b is a single ANDNOT
+    if (type == OP_AND && nOps > 0 && ops[nOps - 1].type == OP_NOT) {
+        ops[nOps - 1].type = OP_ANDNOT;
+        return;
+    }
+    ops = realloc(ops, (nOps + 1) * sizeof(struct op));
+    ops[nOps].type = type;
+    ops[nOps].bit = bit;
+    ++nOps;
+}
+
+// read the next token into a malloc'd string; operators come back as
+// "!", "&", "|", "(" and ")", names as themselves with *quoted set if they
+// were quoted (so "and" can be a checkbox); NULL at the end of the input
+static char* nextToken(int* quoted) {
+    while (*input == ' ' || *input == '\t' || *input == '\n') ++input;
+    *quoted = 0;
+    if (*input == '\0') return NULL;
+    if (strchr("!&|()", *input)) return strndup(input++, 1);
+
+    const char* start = input;
+    if (*input == '"') {
+        *quoted = 1;
+        start = ++input;
+        while (*input != '\0' && *input != '"') ++input;
+        char* tok = strndup(start, input - start);
+        if (*input == '"') ++input;
+        return tok;
+    }
+    while (*input != '\0' && !strchr(" \t\n!&|()\"", *input)) ++input;
+    char* tok = strndup(start, input - start);
+    if (strcasecmp(tok, "not") == 0) strcpy(tok, "!");
+    else if (strcasecmp(tok, "and") == 0) strcpy(tok, "&");
+    else if (strcasecmp(tok, "or") == 0) strcpy(tok, "|");
+    return tok;
+}
+
+static char* peeked = NULL;
+static int peekedQuoted = 0;
+
+static char* peek() {
+    if (peeked == NULL) peeked = nextToken(&peekedQuoted);
+    return peeked;
+}
+
+static void consume() {
+    free(peeked);
+    peeked = NULL;
+}
+
+// whether the next token is the operator op
+static int peekOp(const char* op) {
+    return peek() != NULL && !peekedQuoted && strcmp(peeked, op) == 0;
+}
+
+// index of the checkbox called name (or category:name), -1 if there isn't
+// exactly one
+static ssize_t findChkbox(const char* name) {
+    ssize_t found = -1;
+    size_t i, j, bit = 0, matches = 0;
+    const char* colon = strchr(name, ':');
+    for (i = 0; i < nCategories; ++i) {
+        size_t catLen = strlen(categories[i].name);
+        for (j = 0; j < categories[i].nChkboxes; ++j, ++bit) {
+            const char* box = categories[i].chkboxes[j];
+            if (strcmp(box, name) == 0 || (colon != NULL &&
+                    (size_t)(colon - name) == catLen &&
+                    strncmp(name, categories[i].name, catLen) == 0 &&
+                    strcmp(box, colon + 1) == 0)) {
+                found = bit;
+                ++matches;
+            }
+        }
+    }
+    if (matches > 1) {
+        parseError("ambiguous checkbox `%s' (write it as "
+            "category:checkbox)", name);
+        return -1;
+    }
+    if (matches == 0) parseError("no checkbox called `%s'", name);
+    return found;
+}
+
+static int parseOr();
+
+static int parseFactor() {
+    char* tok = peek();
+    if (tok == NULL) {
+        parseError("expression ended unexpectedly");
+        return 1;
+    }
+    if (peekOp("!")) {
+        consume();
+        if (parseFactor() != 0) return 1;
+        emit(OP_NOT, 0);
+        return 0;
+    }
+    if (peekOp("(")) {
+        consume();
+        if (parseOr() != 0) return 1;
+        if (!peekOp(")")) {
+            parseError("missing `)'");
+            return 1;
+        }
+        consume();
+        return 0;
+    }
+    if (peekOp("&") || peekOp("|") || peekOp(")")) {
+        parseError("unexpected `%s'", tok);
+        return 1;
+    }
+    ssize_t bit = findChkbox(tok);
+    consume();
+    if (bit == -1) return 1;
+    emit(OP_LABEL, bit);
+    return 0;
+}
+
+static int parseAnd() {
+    if (parseFactor() != 0) return 1;
+    while (peekOp("&")) {
+        consume();
+        if (parseFactor() != 0) return 1;
+        emit(OP_AND, 0);
+    }
+    return 0;
+}
+
+static int parseOr() {
+    if (parseAnd() != 0) return 1;
+    while (peekOp("|")) {
+        consume();
+        if (parseAnd() != 0) return 1;
+        emit(OP_OR, 0);
+    }
+    return 0;
+}
+
+static int compile(const char* expr) {
+    input = expr;
+    if (parseOr() != 0) return 1;
+    if (peek() != NULL) {
+        parseError("unexpected `%s'", peeked);
+        return 1;
+    }
+    return 0;
+}
+
+const char* queryCompile(const char* expr) {
+    // (a failed compile can leave a token behind)
+    consume();
+    nOps = 0;
+    int failed = expr != NULL && compile(expr);
+    consume();
+    stack = realloc(stack, (nOps + 1) * CHUNK_WORDS * sizeof(uint64_t));
+    if (failed) {
+        nOps = 0;
+        return error;
+    }
+    return NULL;
+}
+
+// gather checkbox `bit' of files first .. first + CHUNK_WORDS * 64 - 1
+// (first is a multiple of 64, so that's just part of its column)
+static void gather(uint64_t* v, size_t first, size_t bit) {
+    size_t w, words = (nFiles + 63) >> 6;
+    for (w = 0; w < CHUNK_WORDS; ++w) {
+        size_t word = (first >> 6) + w;
+        v[w] = word < words ? labelColumns[bit][word] : 0;
+    }
+}
+
+// evaluate the expression for one chunk of files; the result is left in
+// stack[0 .. CHUNK_WORDS - 1]
+static void evaluate(size_t first) {
+    uint64_t* top = stack;  // one past the top vector
+    size_t i, w;
+    for (i = 0; i < nOps; ++i) {
+        if (ops[i].type == OP_LABEL) {
+            gather(top, first, ops[i].bit);
+            top += CHUNK_WORDS;
+            continue;
+        }
+        // the operands: a (under) and b (on top)
+        uint64_t *b = top - CHUNK_WORDS, *a = b - CHUNK_WORDS;
+        switch (ops[i].type) {
+            case OP_NOT:
+                for (w = 0; w < CHUNK_WORDS; ++w) b[w] = ~b[w];
+                break;
+            case OP_AND:
+                for (w = 0; w < CHUNK_WORDS; ++w) a[w] &= b[w];
+                top = b;
+                break;
+            case OP_OR:
+                for (w = 0; w < CHUNK_WORDS; ++w) a[w] |= b[w];
+                top = b;
+                break;
+            case OP_ANDNOT:
+                for (w = 0; w < CHUNK_WORDS; ++w) a[w] &= ~b[w];
+                top = b;
+                break;
+            case OP_LABEL:
+                break;
+        }
+    }
+    if (nOps == 0) {
+        // no expression: everything
+        for (w = 0; w < CHUNK_WORDS; ++w) stack[w] = ~(uint64_t)0;
+    }
+    // (NOT sets bits past the last file, too)
+    for (w = 0; w < CHUNK_WORDS; ++w) {
+        size_t base = first + (w << 6);
+        if (base >= nFiles) stack[w] = 0;
+        else if (nFiles - base < 64) {
+            stack[w] &= ((uint64_t)1 << (nFiles - base)) - 1;
+        }
+    }
+}
+
+void queryEvaluate(uint64_t* out, size_t firstWord, size_t nWords) {
+    while (nWords > 0) {
+        size_t n = nWords < CHUNK_WORDS ? nWords : CHUNK_WORDS;
+        evaluate(firstWord << 6);
+        memcpy(out, stack, n * sizeof(uint64_t));
+        out += n;
+        firstWord += n;
+        nWords -= n;
+    }
+}
+
+enum format { FORMAT_LINES, FORMAT_CSV, FORMAT_JSON };
+
+static void putCsvField(const char* s) {
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        fputs(s, stdout);
+        return;
+    }
+    putchar('"');
+    for (; *s; ++s) {
+        if (*s == '"') putchar('"');
+        putchar(*s);
+    }
+    putchar('"');
+}
+
+static void putJsonString(const char* s) {
+    putchar('"');
+    for (; *s; ++s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') printf("\\%c", c);
+        else if (c < 0x20) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+}
+
+static void printHeader(enum format format) {
+    size_t i, j;
+    if (format == FORMAT_CSV) {
+        fputs("file", stdout);
+        for (i = 0; i < nCategories; ++i) {
+            for (j = 0; j < categories[i].nChkboxes; ++j) {
+                // (the whole field might need quoting, so build it first)
+                size_t len = strlen(categories[i].name) +
+                    strlen(categories[i].chkboxes[j]) + 2;
+                char* name = malloc(len);
+                snprintf(name, len, "%s:%s", categories[i].name,
+                    categories[i].chkboxes[j]);
+                putchar(',');
+                putCsvField(name);
+                free(name);
+            }
+        }
+        putchar('\n');
+    } else if (format == FORMAT_JSON) {
+        putchar('[');
+    }
+}
+
+static void printFile(enum format format, size_t file, int first) {
+    size_t i, j, bit = 0;
+    if (format == FORMAT_LINES) {
+        puts(fileName(file));
+    } else if (format == FORMAT_CSV) {
+        putCsvField(fileName(file));
+        for (i = 0; i < nCategories; ++i) {
+            for (j = 0; j < categories[i].nChkboxes; ++j, ++bit) {
+                fputs(getLabel(file, bit) ? ",1" : ",0", stdout);
+            }
+        }
+        putchar('\n');
+    } else {
+        // {"file": ..., "labels": {category: [checked checkboxes]}}
+        fputs(first ? "\n" : ",\n", stdout);
+        fputs("{\"file\": ", stdout);
+        putJsonString(fileName(file));
+        fputs(", \"labels\": {", stdout);
+        for (i = 0; i < nCategories; ++i) {
+            if (i > 0) fputs(", ", stdout);
+            putJsonString(categories[i].name);
+            fputs(": [", stdout);
+            int any = 0;
+            for (j = 0; j < categories[i].nChkboxes; ++j, ++bit) {
+                if (!getLabel(file, bit)) continue;
+                if (any++) fputs(", ", stdout);
+                putJsonString(categories[i].chkboxes[j]);
+            }
+            putchar(']');
+        }
+        fputs("}}", stdout);
+    }
+}
+
+// parse the -f option; returns -1 on an unknown option
+static int parseFormat(int argc, char* argv[], enum format* format) {
+    int opt;
+    *format = FORMAT_LINES;
+    while ((opt = getopt(argc, argv, "f:")) != -1) {
+        if (opt == 'f' && strcmp(optarg, "lines") == 0) {
+            *format = FORMAT_LINES;
+        } else if (opt == 'f' && strcmp(optarg, "csv") == 0) {
+            *format = FORMAT_CSV;
+        } else if (opt == 'f' && strcmp(optarg, "json") == 0) {
+            *format = FORMAT_JSON;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int query(int argc, char* argv[]) {
+    enum format format;
+    if (parseFormat(argc, argv, &format) != 0 || argc > optind + 1) {
+        fprintf(stderr, "usage: imgctool query [-f lines|csv|json] "
+            "[EXPRESSION]\n");
+        return 1;
+    }
+
+    if (restore() != 0) return 1;
+    const char* err = queryCompile(optind < argc ? argv[optind] : NULL);
+    if (err != NULL) {
+        fprintf(stderr, "%s\nin expression `%s'\n", err, argv[optind]);
+        return 1;
+    }
+
+    static char outBuf[1 << 16];
+    setvbuf(stdout, outBuf, _IOFBF, sizeof(outBuf));
+
+    printHeader(format);
+    size_t first, w, matches = 0;
+    for (first = 0; first < nFiles; first += CHUNK_WORDS * 64) {
+        evaluate(first);
+        for (w = 0; w < CHUNK_WORDS; ++w) {
+            uint64_t x = stack[w];
+            while (x != 0) {
+                size_t file = first + (w << 6) + __builtin_ctzll(x);
+                x &= x - 1;
+                printFile(format, file, matches++ == 0);
+            }
+        }
+    }
+    if (format == FORMAT_JSON) fputs(matches ? "\n]\n" : "]\n", stdout);
+
+    if (fflush(stdout) != 0) {
+        perror("error writing output");
+        return 1;
+    }
+    return 0;
+}
+
+int stats(int argc, char* argv[]) {
+    enum format format;
+    if (parseFormat(argc, argv, &format) != 0 || argc > optind) {
+        fprintf(stderr, "usage: imgctool stats [-f lines|csv|json]\n");
+        return 1;
+    }
+
+    if (restore() != 0) return 1;
+    statsRecount();
+
+    size_t i, j, bit = 0;
+    if (format == FORMAT_LINES) {
+        printf("files\t%zu\nunlabeled\t%zu\n", nFiles, nUnlabeled);
+        for (i = 0; i < nCategories; ++i) {
+            for (j = 0; j < categories[i].nChkboxes; ++j, ++bit) {
+                printf("%s:%s\t%zu\n", categories[i].name,
+                    categories[i].chkboxes[j], chkboxCounts[bit]);
+            }
+        }
+    } else if (format == FORMAT_CSV) {
+        printf("category,checkbox,count\n,files,%zu\n,unlabeled,%zu\n",
+            nFiles, nUnlabeled);
+        for (i = 0; i < nCategories; ++i) {
+            for (j = 0; j < categories[i].nChkboxes; ++j, ++bit) {
+                putCsvField(categories[i].name);
+                putchar(',');
+                putCsvField(categories[i].chkboxes[j]);
+                printf(",%zu\n", chkboxCounts[bit]);
+            }
+        }
+    } else {
+        // {"files": n, "unlabeled": n, "counts": {category: {checkbox: n}}}
+        printf("{\"files\": %zu, \"unlabeled\": %zu, \"counts\": {",
+            nFiles, nUnlabeled);
+        for (i = 0; i < nCategories; ++i) {
+            fputs(i ? ",\n  " : "\n  ", stdout);
+            putJsonString(categories[i].name);
+            fputs(": {", stdout);
+            for (j = 0; j < categories[i].nChkboxes; ++j, ++bit) {
+                if (j > 0) fputs(", ", stdout);
+                putJsonString(categories[i].chkboxes[j]);
+                printf(": %zu", chkboxCounts[bit]);
+            }
+            putchar('}');
+        }
+        fputs(nCategories ? "\n}}\n" : "}}\n", stdout);
+    }
+
+    if (fflush(stdout) != 0) {
+        perror("error writing output");
+        return 1;
+    }
+    return 0;
+}
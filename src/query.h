@@ -0,0 +1,30 @@
+#ifndef __QUERY_H__
+#define __QUERY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// `imgctool query [-f lines|csv|json] [EXPRESSION]': print the labeled files
+// matching a boolean expression over checkbox names, without the interface
+// names can be written as category:checkbox when a checkbox name isn't
+// unique, and quoted ("...") if they contain spaces or operators; operators
+// are ! (or not), & (or and), | (or or) and parentheses
+// argv[0] is "query"; returns the exit status
+int query(int argc, char* argv[]);
+
+// compile an expression (as above; NULL matches every file) for
+// queryEvaluate(), replacing the last one; returns NULL if it compiled,
+// otherwise what's wrong with it
+// checkboxes are looked up now, so compile again after adding or deleting one
+const char* queryCompile(const char* expr);
+
+// which of files firstWord * 64 .. (firstWord + nWords) * 64 - 1 match the
+// compiled expression, as a bitmap of nWords words (file firstWord * 64 + i
+// is bit i % 64 of out[i / 64])
+void queryEvaluate(uint64_t* out, size_t firstWord, size_t nWords);
+
+// `imgctool stats [-f lines|csv|json]': print how many files have each
+// checkbox checked, and how many have none
+int stats(int argc, char* argv[]);
+
+#endif
@@ -1,242 +1,1110 @@
 #include "saverestore.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "ictdata.h"
+#include "journal.h"
+#include "dedupe.h"
+#include "order.h"
+#include "trace.h"
 
-static const char SAVE_FILE[] = ".imgctool";
+static const char DEFAULT_SAVE_FILE[] = ".imgctool";
+static const char FORMAT_VERSION = '\x02';
+// the same, except that the labels are in a COLS section instead of rows
+static const char COLUMNS_VERSION = '\x03';
+// kinds of container in COLS
+static const char COL_ARRAY = 'A', COL_RUNS = 'R', COL_BITMAP = 'B';
+static const char RECORD_SEP = '\x1e', UNIT_SEP = '\x1f';
+static const size_t STAMP_SIZE = 32;  // per file in the HASH section
+static const size_t INDEX_STRIDE = 64;  // files per FOFF entry
+static const char TMP_SUFFIX[] = ".tmp";
+static const char LOCK_SUFFIX[] = ".lock";
+
+// see saveFileName()
+static const char* saveFile = NULL;
+
+// file being restored (or merged), where it's mapped, and its separators
+// (see restoreHeader())
+static const char* readFile;
+static const char* mapStart;
+static char recordSep, unitSep;
+static int columnar;
+
+// when the save file has an index, filenames are only read from it (it stays
+// mapped) as they're needed: the names of files i * indexStride onwards start
+// at mapStart + the ith offset at indexOffsets, and they all end by namesEnd
+static const char* lazyMap = NULL;
+static const char *indexOffsets, *namesEnd;
+static size_t indexStride;
+
+// when merging another file into the current labels (see restoreMerge()),
+// its files and checkboxes are at fileMap[i] and bitMap[b] in ours
+static int merging = 0;
+static size_t *fileMap = NULL, *bitMap = NULL;
+static size_t nMapFiles = 0, nMapBits = 0;
 
 // utility methods
 static int bitsToChars(int bits);
+static void encodeLE(unsigned char* buf, uint64_t x);
+static void putLE(FILE* f, uint64_t x);
+static uint64_t getLE(const char* p);
+static char* withSuffix(const char* path, const char* suffix);
+static void putRow(unsigned char* buf, const uint64_t* row, size_t chars);
+static void getRow(uint64_t* row, const unsigned char* buf, size_t chars);
+static size_t varintLen(uint64_t x);
+static size_t putVarint(unsigned char* buf, uint64_t x);
+static int getVarint(const char** p, const char* end, uint64_t* x);
+
+// everything a snapshot needs that the interface might change while it's
+// being written (files[] and fileStamps[] don't change after startup)
+struct snapshot {
+    struct ictCategory* categories;  // (names are in the arena, so shared)
+    size_t nCategories;
+    size_t nFiles;
+    uint64_t* labels;  // column n is at labels + n * labelWords
+    size_t labelWords;
+};
+
+// a checkbox's column while it's being encoded (see encodeColumns()): files
+// are added in order, and each run is only written out once it's over
+struct column {
+    char kind;  // (0 while just measuring)
+    size_t next, gap, runLen;
+    size_t arrayBytes, runBytes, size;
+    unsigned char* pos;
+};
+
+// save() sub-methods
+static struct snapshot* takeSnapshot();
+static void freeSnapshot(struct snapshot* snap);
+static int saveSnapshot(const struct snapshot* snap);
+static unsigned char* encodeColumns(const struct snapshot* snap, size_t nBits,
+    size_t* size);
+static void scanColumns(const struct snapshot* snap, size_t nBits,
+    struct column* cols);
+static void columnAdd(struct column* col, size_t file);
+static void columnEndRun(struct column* col);
+static void saveRows(FILE* f, const struct snapshot* snap, size_t nBits);
+static void saveHashes(FILE* f, size_t n);
+static void saveOrder(FILE* f, size_t n);
+static void saveIndex(FILE* f, const struct snapshot* snap, long namesOffset,
+    long labelsOffset, long columnsOffset, long hashOffset, long orderOffset);
+static void syncDir(const char* path);
 
 // restore() sub-methods
-static int restoreHeader(FILE* f);
-static int restoreCategories(FILE* f);
-static int restoreFilenames(FILE* f);
-static int restoreFileData(FILE* f);
+static int restoreFile(const char* path);
+static int restoreHeader(const char** p, const char* end);
+static int restoreCategories(const char** p, const char* end);
+static int restoreFilenames(const char** p, const char* end);
+static int restoreIndex(const char* names, const char* p, const char* end);
+static const char* lazyName(size_t file, size_t* len);
+static int restoreFileData(const char** p, const char* end);
+static int restoreColumns(const char* p, const char* end);
+static void restoreLabel(size_t file, size_t bit);
+static int restoreOrder(const char* p, const char* end);
+static int restoreSections(const char* p, const char* end);
+
+// restoreMerge() sub-methods
+static size_t mergeCategory(const char* name, size_t len);
+static void mergeChkbox(size_t categoryIdx, const char* name, size_t len);
+static int mergeFilenames(const char* q, const char* listEnd);
+static int mergeFileData(const char** p, const char* end);
 
 // File format:
-// header: 4 bytes, 0x89 "ICT"
-// ([categoryname](0x31[chkboxname])+0x30)*
-// 0x30
-// filenames, separated by 0x31, with an 0x30 at the end
+// header: 4 bytes, 0x89 "ICT", then a version byte (0x02, or 0x03 if the file
+//   data is in a COLS section instead)
+// ([categoryname](0x1F[chkboxname])+0x1E)*
+// 0x1E
+// filenames, separated by 0x1F, with an 0x1E at the end
 // file data, each in the least amount of bytes to fit (total number of
 //   checkboxes) bits
+// then any number of sections: a 4 byte tag, the length of the rest of the
+//   section as a little-endian uint64, and the section itself; readers skip
+//   tags they don't know
+// "COLS": for every checkbox, a container of the files it's checked for: a
+//   kind byte, the length of the rest as a uint64, and then either
+//   'A': the gap before each file, as LEB128 varints (the gap before the
+//     first file is its index, and before the others the number of files
+//     since the previous one, not counting it)
+//   'R': runs of consecutive files, as varint pairs of the gap before the
+//     run and its length
+//   'B': a bitmap, the bit i % 8 of byte i / 8 for file i
+//   whichever is smallest; this is only written if all of them together are
+//   smaller than the file data
+// "HASH": for every file, its size, mtime (seconds, nanoseconds) and XXH64
+//   as little-endian uint64s (see dedupe.h)
+// "ORDR": for every file, the position it was added in (see order.h), as a
+//   varint; only written if files[] isn't in that order
+// "FOFF": the number of files n per entry, then for every nth file the offset
+//   (from the start of the save file) of its name
+// "TOC ": always last; the number of files and the offsets of the filenames
+//   and the file data, then a 4 byte tag and an offset for every other
+//   section, and finally the offset of this section itself (so it can be
+//   found from the end of the file)
+// With FOFF and TOC, restoring doesn't have to read the filenames at all.
+// All integers are little-endian uint64s, and offsets are from the start of
+// the save file.
+// Label edits made since this snapshot was written are appended to a journal
+// next to it instead of rewriting the whole file (see journal.c).
+// Files without the version byte are from older versions, which used 0x30 and
+// 0x31 (the characters '0' and '1') as separators instead, and so couldn't
+// store names containing those; they can still be read.
 
 // this is a little ugly
 // (... it's pretty bad)
-#define ERR_READ() do { fprintf(stderr, "error reading file %s\n", SAVE_FILE); fclose(f); return 1; } while (0)
-#define ERR_WRITE() do { fprintf(stderr, "error writing to file %s\n", SAVE_FILE); fclose(f); return 1; } while (0)
-#define ERR_HEADER() do { fprintf(stderr, "file %s corrupted? (invalid header)\n", SAVE_FILE); fclose(f); return 1; } while (0)
-#define ERR_TERM() do { fprintf(stderr, "file %s terminated prematurely?\n", SAVE_FILE); fclose(f); return 1; } while (0)
-#define ERR_TRAIL() do { fprintf(stderr, "trailing data in %s?\n", SAVE_FILE); fclose(f); return 1; } while (0)
-#define ERR_ZERO() do { fprintf(stderr, "zero length name in %s?\n", SAVE_FILE); fclose(f); return 1; } while (0)
+#define ERR_READ() do { fprintf(stderr, "error reading file %s\n", readFile); return 1; } while (0)
+#define ERR_WRITE() do { fprintf(stderr, "error writing to file %s\n", saveFileName()); return 1; } while (0)
+#define ERR_HEADER() do { fprintf(stderr, "file %s corrupted? (invalid header)\n", readFile); return 1; } while (0)
+#define ERR_TERM() do { fprintf(stderr, "file %s terminated prematurely?\n", readFile); return 1; } while (0)
+#define ERR_TRAIL() do { fprintf(stderr, "trailing data in %s?\n", readFile); return 1; } while (0)
+#define ERR_ZERO() do { fprintf(stderr, "zero length name in %s?\n", readFile); return 1; } while (0)
+#define ERR_LABELS() do { fprintf(stderr, "file %s corrupted? (invalid labels)\n", readFile); return 1; } while (0)
+#define ERR_ORDER() do { fprintf(stderr, "file %s corrupted? (invalid file order)\n", readFile); return 1; } while (0)
+
+// held by whoever changes what save() reads, and by save() while it copies it
+static pthread_mutex_t stateLock = PTHREAD_MUTEX_INITIALIZER;
+// one save at a time
+static pthread_mutex_t saveLock = PTHREAD_MUTEX_INITIALIZER;
+
+const char* saveFileName() {
+    if (saveFile == NULL) {
+        const char* env = getenv("IMG_SAVE_FILE");
+        saveFile = env != NULL && *env != '\0' ? env : DEFAULT_SAVE_FILE;
+    }
+    return saveFile;
+}
+
+void setSaveFile(const char* path) {
+    saveFile = path;
+}
+
+// take the lock on save file `saved' (without waiting for it); returns the
+// descriptor that holds it, or -1 if another imgctool has it
+static int lockFile(const char* saved) {
+    char* path = withSuffix(saved, LOCK_SUFFIX);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    free(path);
+    if (fd == -1) return -1;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int lockSaveFile() {
+    // (the descriptor is kept open, and so the lock held, until exit)
+    return lockFile(saveFileName()) == -1;
+}
+
+void lockState() {
+    pthread_mutex_lock(&stateLock);
+}
+
+void unlockState() {
+    pthread_mutex_unlock(&stateLock);
+}
 
 int save() {
-    FILE* f = fopen(SAVE_FILE, "wb");
-    if (f == NULL) ERR_WRITE();
+    pthread_mutex_lock(&saveLock);
+    uint64_t t = traceBegin();
+
+    // copy what's needed, so the interface can carry on while it's written
+    struct snapshot* snap = NULL;
+    lockState();
+    if (journalNeedsSnapshot()) {
+        snap = takeSnapshot();
+        journalSnapshotTaken();
+    }
+    unlockState();
+
+    int err;
+    if (snap == NULL) {
+        // only label changes since the last snapshot? then just append those
+        err = journalFlush(saveFileName());
+    } else {
+        err = saveSnapshot(snap);
+        freeSnapshot(snap);
+        if (err == 0) journalReset(saveFileName());
+        else journalInvalidate();  // try again next time
+    }
+
+    traceEnd(TRACE_SAVE, t, 0);
+    pthread_mutex_unlock(&saveLock);
+
+    return err;
+}
+
+struct snapshot* takeSnapshot() {
+    struct snapshot* snap = malloc(sizeof(struct snapshot));
+    size_t i;
+    snap->nCategories = nCategories;
+    snap->categories = malloc((nCategories + 1) * sizeof(struct ictCategory));
+    for (i = 0; i < nCategories; ++i) {
+        snap->categories[i] = categories[i];
+        snap->categories[i].chkboxes = malloc(
+            (categories[i].nChkboxes + 1) * sizeof(char*));
+        memcpy(snap->categories[i].chkboxes, categories[i].chkboxes,
+            categories[i].nChkboxes * sizeof(char*));
+    }
+    // (copying the labels is the only part the interface waits for)
+    size_t nBits = chkboxCount(), words = (nFiles + 63) >> 6;
+    snap->nFiles = nFiles;
+    snap->labelWords = words;
+    snap->labels = malloc((nBits * words + 1) * sizeof(uint64_t));
+    for (i = 0; i < nBits; ++i) {
+        memcpy(snap->labels + i * words, labelColumns[i],
+            words * sizeof(uint64_t));
+    }
+    return snap;
+}
+
+void freeSnapshot(struct snapshot* snap) {
+    size_t i;
+    for (i = 0; i < snap->nCategories; ++i) free(snap->categories[i].chkboxes);
+    free(snap->categories);
+    free(snap->labels);
+    free(snap);
+}
+
+int saveSnapshot(const struct snapshot* snap) {
+    // written next to the real file and renamed over it once it's safely on
+    // disk, so a crash halfway through leaves the old one intact
+    char* tmp = withSuffix(saveFileName(), TMP_SUFFIX);
+    FILE* f = fopen(tmp, "wb");
+    if (f == NULL) {
+        free(tmp);
+        ERR_WRITE();
+    }
+
+    size_t i, j, nBits = 0;
+    for (i = 0; i < snap->nCategories; ++i) {
+        nBits += snap->categories[i].nChkboxes;
+    }
+    size_t columnsSize;
+    unsigned char* columns = encodeColumns(snap, nBits, &columnsSize);
 
     // write header
     fwrite("\x89ICT", sizeof(char), 4, f);
+    fputc(columns != NULL ? COLUMNS_VERSION : FORMAT_VERSION, f);
 
     // write categories and checkboxes
-    int i, j;
-    for (i = 0; i < nCategories; ++i) {
-        fwrite(categories[i].name, sizeof(char),
-            strlen(categories[i].name), f);
-        for (j = 0; j < categories[i].nChkboxes; ++j) {
-            fputc('\x31', f);
-            fwrite(categories[i].chkboxes[j], sizeof(char),
-                strlen(categories[i].chkboxes[j]), f);
+    for (i = 0; i < snap->nCategories; ++i) {
+        const struct ictCategory* cat = &snap->categories[i];
+        fwrite(cat->name, sizeof(char), strlen(cat->name), f);
+        for (j = 0; j < cat->nChkboxes; ++j) {
+            fputc(UNIT_SEP, f);
+            fwrite(cat->chkboxes[j], sizeof(char), strlen(cat->chkboxes[j]),
+                f);
         }
-        fputc('\x30', f);
+        fputc(RECORD_SEP, f);
     }
-    fputc('\x30', f);
+    fputc(RECORD_SEP, f);
 
     // write filenames
-    if (nFiles >= 1) {
-        fwrite(files[0].filename, sizeof(char), strlen(files[0].filename), f);
+    long namesOffset = ftell(f);
+    for (i = 0; i < snap->nFiles; ++i) {
+        if (i != 0) fputc(UNIT_SEP, f);
+        fputs(fileName(i), f);
     }
-    for (i = 1; i < nFiles; ++i) {
-        fputc('\x31', f);
-        fwrite(files[i].filename, sizeof(char), strlen(files[i].filename), f);
+    fputc(RECORD_SEP, f);
+    long labelsOffset = ftell(f);
+
+    // write file data (most significant byte first), or the columns
+    long columnsOffset = -1;
+    if (columns != NULL) {
+        columnsOffset = labelsOffset;
+        fwrite("COLS", sizeof(char), 4, f);
+        putLE(f, columnsSize);
+        fwrite(columns, sizeof(char), columnsSize, f);
+        free(columns);
+    } else {
+        saveRows(f, snap, nBits);
     }
-    fputc('\x30', f);
 
-    // write file data
-    int chkboxCount = 0;
-    for (i = 0; i < nCategories; ++i) chkboxCount += categories[i].nChkboxes;
-    int chars = bitsToChars(chkboxCount);
-    for (i = 0; i < nFiles; ++i) {
-        for (j = chars - 1; j >= 0; --j) {
-            fputc((char)((files[i].data >> (j*8)) & 0xFF), f);
-        }
+    long hashOffset = -1;
+    if (fileStamps != NULL) {
+        hashOffset = ftell(f);
+        saveHashes(f, snap->nFiles);
     }
+    long orderOffset = -1;
+    if (fileAdded != NULL) {
+        orderOffset = ftell(f);
+        saveOrder(f, snap->nFiles);
+    }
+    saveIndex(f, snap, namesOffset, labelsOffset, columnsOffset, hashOffset,
+        orderOffset);
 
-    fclose(f);
+    int err = ferror(f) || fflush(f) != 0 || fsync(fileno(f)) != 0;
+    if (fclose(f) != 0) err = 1;
+    if (err || rename(tmp, saveFileName()) != 0) {
+        unlink(tmp);
+        free(tmp);
+        ERR_WRITE();
+    }
+    free(tmp);
+    // (and make sure the rename itself is on disk)
+    syncDir(saveFileName());
     return 0;
 }
 
+void syncDir(const char* path) {
+    const char* slash = strrchr(path, '/');
+    char* dir = slash == NULL ? strdup(".") : strndup(path, slash - path + 1);
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+// the labels as a container per checkbox (see the file format), or NULL if
+// that wouldn't be any smaller than a row per file
+unsigned char* encodeColumns(const struct snapshot* snap, size_t nBits,
+        size_t* size) {
+    if (nBits == 0 || snap->nFiles == 0) return NULL;
+    struct column* cols = calloc(nBits, sizeof(struct column));
+    size_t b, total = 0, bitmapBytes = (snap->nFiles + 7) / 8;
+
+    // first measure every kind of container, and pick the smallest
+    scanColumns(snap, nBits, cols);
+    for (b = 0; b < nBits; ++b) {
+        struct column* col = &cols[b];
+        col->kind = COL_ARRAY;
+        col->size = col->arrayBytes;
+        if (col->runBytes < col->size) {
+            col->kind = COL_RUNS;
+            col->size = col->runBytes;
+        }
+        if (bitmapBytes < col->size) {
+            col->kind = COL_BITMAP;
+            col->size = bitmapBytes;
+        }
+        total += 9 + col->size;
+    }
+    if (total >= snap->nFiles * bitsToChars(nBits)) {
+        free(cols);
+        return NULL;
+    }
+
+    // then go around again to fill them in
+    unsigned char* buf = calloc(total, 1);
+    unsigned char* q = buf;
+    for (b = 0; b < nBits; ++b) {
+        struct column* col = &cols[b];
+        uint64_t len = col->size;
+        q[0] = col->kind;
+        encodeLE(q + 1, len);
+        col->pos = q + 9;
+        col->next = 0;
+        q += 9 + col->size;
+    }
+    scanColumns(snap, nBits, cols);
+
+    free(cols);
+    *size = total;
+    return buf;
+}
+
+// add every checked label to its column (only those are visited, so this is
+// quick for the sparse sets columns are for)
+void scanColumns(const struct snapshot* snap, size_t nBits,
+        struct column* cols) {
+    size_t b, w;
+    for (b = 0; b < nBits; ++b) {
+        const uint64_t* col = snap->labels + b * snap->labelWords;
+        uint64_t x;
+        for (w = 0; w < snap->labelWords; ++w) {
+            for (x = col[w]; x != 0; x &= x - 1) {
+                columnAdd(&cols[b], (w << 6) | __builtin_ctzll(x));
+            }
+        }
+        columnEndRun(&cols[b]);
+    }
+}
+
+void columnAdd(struct column* col, size_t file) {
+    size_t gap = file - col->next;
+    if (col->kind == 0) {
+        col->arrayBytes += varintLen(gap);
+    } else if (col->kind == COL_ARRAY) {
+        col->pos += putVarint(col->pos, gap);
+    } else if (col->kind == COL_BITMAP) {
+        col->pos[file >> 3] |= 1 << (file & 7);
+    }
+    if (col->runLen != 0 && gap == 0) {
+        ++col->runLen;
+    } else {
+        columnEndRun(col);
+        col->gap = gap;
+        col->runLen = 1;
+    }
+    col->next = file + 1;
+}
+
+void columnEndRun(struct column* col) {
+    if (col->runLen == 0) return;
+    if (col->kind == 0) {
+        col->runBytes += varintLen(col->gap) + varintLen(col->runLen);
+    } else if (col->kind == COL_RUNS) {
+        col->pos += putVarint(col->pos, col->gap);
+        col->pos += putVarint(col->pos, col->runLen);
+    }
+    col->runLen = 0;
+}
+
+// write the file data (see the file format), turning the columns into rows
+// 64 files at a time
+void saveRows(FILE* f, const struct snapshot* snap, size_t nBits) {
+    size_t chars = bitsToChars(nBits), stride = (nBits + 63) >> 6, w, b, j;
+    uint64_t* rows = malloc((64 * stride + 1) * sizeof(uint64_t));
+    unsigned char* buf = malloc(chars + 1);
+    for (w = 0; w < snap->labelWords; ++w) {
+        memset(rows, 0, 64 * stride * sizeof(uint64_t));
+        for (b = 0; b < nBits; ++b) {
+            uint64_t x;
+            for (x = snap->labels[b * snap->labelWords + w]; x != 0;
+                    x &= x - 1) {
+                rows[__builtin_ctzll(x) * stride + (b >> 6)] |=
+                    (uint64_t)1 << (b & 63);
+            }
+        }
+        size_t n = snap->nFiles - (w << 6);
+        for (j = 0; j < n && j < 64; ++j) {
+            putRow(buf, rows + j * stride, chars);
+            fwrite(buf, sizeof(char), chars, f);
+        }
+    }
+    free(rows);
+    free(buf);
+}
+
+void saveHashes(FILE* f, size_t n) {
+    size_t i;
+    fwrite("HASH", sizeof(char), 4, f);
+    putLE(f, n * STAMP_SIZE);
+    for (i = 0; i < n; ++i) {
+        if (i < nFileStamps) {
+            putLE(f, fileStamps[i].size);
+            putLE(f, fileStamps[i].mtimeSec);
+            putLE(f, fileStamps[i].mtimeNsec);
+            putLE(f, fileStamps[i].hash);
+        } else {
+            putLE(f, UINT64_MAX);
+            putLE(f, 0);
+            putLE(f, 0);
+            putLE(f, 0);
+        }
+    }
+}
+
+void saveOrder(FILE* f, size_t n) {
+    unsigned char* buf = malloc(n * 10 + 1);
+    size_t i, len = 0;
+    for (i = 0; i < n; ++i) len += putVarint(buf + len, orderAdded(i));
+    fwrite("ORDR", sizeof(char), 4, f);
+    putLE(f, len);
+    fwrite(buf, sizeof(char), len, f);
+    free(buf);
+}
+
+void saveIndex(FILE* f, const struct snapshot* snap, long namesOffset,
+        long labelsOffset, long columnsOffset, long hashOffset,
+        long orderOffset) {
+    // (the offsets are worked out again rather than remembered while the
+    // names were written, which would take 8 bytes per file)
+    size_t i, nEntries = (snap->nFiles + INDEX_STRIDE - 1) / INDEX_STRIDE;
+    uint64_t offset = namesOffset;
+    long indexOffset = ftell(f);
+    fwrite("FOFF", sizeof(char), 4, f);
+    putLE(f, 8 + nEntries * 8);
+    putLE(f, INDEX_STRIDE);
+    for (i = 0; i < snap->nFiles; ++i) {
+        if (i % INDEX_STRIDE == 0) putLE(f, offset);
+        offset += strlen(fileName(i)) + 1;
+    }
+
+    long tocOffset = ftell(f);
+    int nSections = 1 + (columnsOffset != -1) + (hashOffset != -1) +
+        (orderOffset != -1);
+    fwrite("TOC ", sizeof(char), 4, f);
+    putLE(f, 8 * 3 + 12 * nSections + 8);
+    putLE(f, snap->nFiles);
+    putLE(f, namesOffset);
+    putLE(f, labelsOffset);
+    if (columnsOffset != -1) {
+        fwrite("COLS", sizeof(char), 4, f);
+        putLE(f, columnsOffset);
+    }
+    if (hashOffset != -1) {
+        fwrite("HASH", sizeof(char), 4, f);
+        putLE(f, hashOffset);
+    }
+    if (orderOffset != -1) {
+        fwrite("ORDR", sizeof(char), 4, f);
+        putLE(f, orderOffset);
+    }
+    fwrite("FOFF", sizeof(char), 4, f);
+    putLE(f, indexOffset);
+    putLE(f, tocOffset);
+}
+
 int restore() {
-    FILE* f = fopen(SAVE_FILE, "rb");
-    if (f == NULL) return 0;
+    int err = restoreFile(saveFileName());
+    if (err) return err;
+
+    // apply edits saved since the snapshot
+    if ((err = journalReplay(saveFileName())) != 0) {
+        fprintf(stderr, "from journalReplay()\n");
+        return err;
+    }
+
+    return 0;
+}
+
+int restoreMerge(const char* path) {
+    // a shard that's still open in an imgctool could be half written (and
+    // lose whatever it saves after this), so hold its lock while reading it
+    // (checking it exists first, so a typo doesn't leave a lock file behind)
+    if (access(path, F_OK) != 0) {
+        fprintf(stderr, "error reading file %s\n", path);
+        return 1;
+    }
+    int lockFd = lockFile(path);
+    if (lockFd == -1) {
+        fprintf(stderr, "fatal: %s is in use by another imgctool, "
+            "aborting\n", path);
+        return 1;
+    }
+
+    merging = 1;
+    int err = restoreFile(path);
+    if (!err && (err = journalMerge(path, nMapFiles, fileMap, nMapBits,
+            bitMap)) != 0) {
+        fprintf(stderr, "from journalMerge()\n");
+    }
+    merging = 0;
+    free(fileMap);
+    free(bitMap);
+    fileMap = bitMap = NULL;
+    nMapFiles = nMapBits = 0;
+    close(lockFd);
+    return err;
+}
+
+int restoreFile(const char* path) {
+    readFile = path;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        // nothing saved yet is fine, but a missing shard isn't
+        if (!merging) return 0;
+        ERR_READ();
+    }
+
+    // map the whole file; everything below just walks a pointer through it
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        ERR_READ();
+    }
+    const char* map = NULL;
+    if (st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            ERR_READ();
+        }
+        madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    const char *p = map, *end = map + st.st_size;
+    mapStart = map;
 
     int err;
 
     // check header
-    if ((err = restoreHeader(f)) != 0) {
+    if ((err = restoreHeader(&p, end)) != 0) {
         fprintf(stderr, "from restoreHeader()\n");
-        return err;
-    }
     // process categories and checkboxes for those categories
-    if ((err = restoreCategories(f)) != 0) {
+    } else if ((err = restoreCategories(&p, end)) != 0) {
         fprintf(stderr, "from restoreCategories()\n");
-        return err;
-    }
     // process filenames
-    if ((err = restoreFilenames(f)) != 0) {
+    } else if ((err = restoreFilenames(&p, end)) != 0) {
         fprintf(stderr, "from restoreFilenames()\n");
-        return err;
-    }
     // and finally, process file data
-    if ((err = restoreFileData(f)) != 0) {
+    } else if ((err = restoreFileData(&p, end)) != 0) {
         fprintf(stderr, "from restoreFileData()\n");
-        return err;
+    // and whatever else there is
+    } else if ((err = restoreSections(p, end)) != 0) {
+        fprintf(stderr, "from restoreSections()\n");
+    }
+    // (unless names are still to be read from it)
+    if (map != NULL && map != lazyMap) munmap((void*)map, st.st_size);
+    return err;
+}
+
+int restoreHeader(const char** p, const char* end) {
+    if (end - *p < 4 || memcmp(*p, "\x89ICT", 4) != 0) ERR_HEADER();
+    *p += 4;
+
+    columnar = 0;
+    if (*p < end && (**p == FORMAT_VERSION || **p == COLUMNS_VERSION)) {
+        columnar = **p == COLUMNS_VERSION;
+        ++*p;
+        recordSep = RECORD_SEP;
+        unitSep = UNIT_SEP;
+    } else {
+        // an old file
+        recordSep = '\x30';
+        unitSep = '\x31';
     }
 
-    fclose(f);
     return 0;
 }
 
-int restoreHeader(FILE* f) {
-    char header[5] = {0};
-    if (fread(header, sizeof(char), 4, f) != 4) {
-        if (feof(f)) ERR_HEADER();
-        else ERR_READ();
+int restoreCategories(const char** p, const char* end) {
+    // categories are terminated by a record separator each, with one more
+    // at the end
+    const char* q = *p;
+    while (1) {
+        if (q == end) ERR_TERM();
+        if (*q == recordSep) break;
+
+        const char* recEnd = memchr(q, recordSep, end - q);
+        if (recEnd == NULL) ERR_TERM();
+        if (*q == unitSep) ERR_ZERO();
+
+        // name, then checkboxes separated by unit separators
+        const char* sep = memchr(q, unitSep, recEnd - q);
+        if (sep == NULL) sep = recEnd;
+        size_t categoryIdx = merging ? mergeCategory(q, sep - q) :
+            pushCategory(q, sep - q) - categories;
+        while (sep != recEnd) {
+            q = sep + 1;
+            if ((sep = memchr(q, unitSep, recEnd - q)) == NULL) sep = recEnd;
+            // (an empty name is tolerated only for the last checkbox, since
+            // that's what older versions did)
+            else if (sep == q) ERR_ZERO();
+            if (merging) mergeChkbox(categoryIdx, q, sep - q);
+            else pushChkbox(&categories[categoryIdx], q, sep - q);
+        }
+
+        q = recEnd + 1;
     }
-    if (strcmp(header, "\x89ICT") != 0) ERR_HEADER();
+    *p = q + 1;
 
     return 0;
 }
 
-int restoreCategories(FILE* f) {
-    int ch = '\x30', lastCh = '\0', processingName = 0, bufLen = 0;
-    struct ictCategory* currentCategory;
-    char* curStr;
+int restoreFilenames(const char** p, const char* end) {
+    // filenames are separated by unit separators and terminated by a
+    // record separator
+    const char* q = *p;
+    const char* listEnd = memchr(q, recordSep, end - q);
+    if (listEnd == NULL) ERR_TERM();
+    *p = listEnd + 1;
+
+    // an empty list means there are no files at all
+    if (q == listEnd) return 0;
+    if (merging) return mergeFilenames(q, listEnd);
+    // nor do they have to be read now if there's an index
+    if (restoreIndex(q, *p, end)) return 0;
+
     while (1) {
-        switch (ch) {
-            case EOF:
-                ERR_TERM();
-            case '\x30':  // ASCII record separator
-                if (lastCh == '\x30') goto categoriesDone;
-                // we're starting a new category
-                categories = realloc(categories, (++nCategories) *
-                    sizeof(struct ictCategory));
-                currentCategory = &categories[nCategories - 1];
-                currentCategory->name = calloc((bufLen = BUF_ADD_SIZE),
-                    sizeof(char));
-                currentCategory->chkboxes = NULL;
-                currentCategory->nChkboxes = 0;
-                processingName = 1;
-                break;
-            case '\x31':  // ASCII unit separator
-                if ((lastCh == '\x30') || (lastCh == '\x31')) ERR_ZERO();
-                // start a new checkbox
-                curStr = calloc((bufLen = BUF_ADD_SIZE), sizeof(char));
-                currentCategory->chkboxes = realloc(currentCategory->chkboxes,
-                    (++currentCategory->nChkboxes) * sizeof(char*));
-                currentCategory->chkboxes[currentCategory->nChkboxes - 1] =
-                    curStr;
-                processingName = 0;
-                break;
-            default: {
-                bufLen = addCh(processingName ? &currentCategory->name :
-                    &curStr, ch, bufLen);
-                break;
+        const char* sep = memchr(q, unitSep, listEnd - q);
+        if (sep == NULL) sep = listEnd;
+        if (sep == q) ERR_ZERO();
+        // this copies (and indexes) the filename
+        pushFileN(q, sep - q);
+        if (sep == listEnd) return 0;
+        q = sep + 1;
+    }
+}
+
+// returns whether the save file has a usable index, in which case the names
+// (from `names' up to just before p) are left to lazyName()
+int restoreIndex(const char* names, const char* p, const char* end) {
+    size_t size = end - mapStart;
+    if (recordSep != RECORD_SEP || size < 12 + 40) return 0;
+
+    // find TOC from the end, and FOFF from TOC
+    uint64_t tocOffset = getLE(end - 8);
+    if (tocOffset > size - 12 - 40) return 0;
+    const char* toc = mapStart + tocOffset;
+    uint64_t tocLen = getLE(toc + 4);
+    if (memcmp(toc, "TOC ", 4) != 0 || tocLen != size - tocOffset - 12 ||
+            (tocLen - 32) % 12 != 0) {
+        return 0;
+    }
+    size_t n = getLE(toc + 12), i;
+    uint64_t namesOffset = getLE(toc + 20), labelsOffset = getLE(toc + 28);
+    if (mapStart + namesOffset != names || mapStart + labelsOffset != p) {
+        return 0;
+    }
+    const char* index = NULL;
+    for (i = 0; i < (tocLen - 32) / 12; ++i) {
+        const char* entry = toc + 36 + i * 12;
+        uint64_t offset = getLE(entry + 4);
+        if (memcmp(entry, "FOFF", 4) == 0 && offset < tocOffset) {
+            index = mapStart + offset;
+        }
+    }
+    if (index == NULL || memcmp(index, "FOFF", 4) != 0) return 0;
+
+    // and check it (one offset for every INDEX_STRIDE or so files, so this
+    // is quick)
+    uint64_t stride = getLE(index + 12);
+    if (stride == 0) return 0;
+    size_t nEntries = (n + stride - 1) / stride;
+    if (getLE(index + 4) != 8 + nEntries * 8 ||
+            index + 20 + nEntries * 8 > toc) {
+        return 0;
+    }
+    for (i = 0; i < nEntries; ++i) {
+        uint64_t offset = getLE(index + 20 + i * 8);
+        if (offset < namesOffset || offset >= labelsOffset) return 0;
+    }
+
+    lazyMap = mapStart;
+    indexOffsets = index + 20;
+    indexStride = stride;
+    namesEnd = p - 1;
+    pushLazyFiles(n, lazyName);
+    return 1;
+}
+
+const char* lazyName(size_t file, size_t* len) {
+    const char* q = lazyMap + getLE(indexOffsets + file / indexStride * 8);
+    size_t i;
+    for (i = file % indexStride; i > 0; --i) {
+        const char* sep = memchr(q, UNIT_SEP, namesEnd - q);
+        q = sep == NULL ? namesEnd : sep + 1;
+    }
+    const char* sep = memchr(q, UNIT_SEP, namesEnd - q);
+    *len = (sep == NULL ? namesEnd : sep) - q;
+    return q;
+}
+
+int restoreFileData(const char** p, const char* end) {
+    // (labels in columns are read along with the other sections)
+    if (columnar) {
+        reserveLabelBits(chkboxCount());
+        return 0;
+    }
+    if (merging) return mergeFileData(p, end);
+
+    // figure out how many checkboxes we have and how many chars fit them
+    size_t i, k, nBits = chkboxCount(), chars = bitsToChars(nBits),
+           stride = (chars + 7) >> 3;
+    reserveLabelBits(nBits);
+
+    if ((end - *p) < nFiles * chars) ERR_TERM();
+
+    const unsigned char* buf = (const unsigned char*)*p;
+    *p += nFiles * chars;
+    uint64_t* row = malloc((stride + 1) * sizeof(uint64_t));
+    for (i = 0; i < nFiles; ++i, buf += chars) {
+        getRow(row, buf, chars);
+        for (k = 0; k < stride; ++k) {
+            uint64_t x;
+            for (x = row[k]; x != 0; x &= x - 1) {
+                size_t bit = (k << 6) | __builtin_ctzll(x);
+                // (older versions could leave stray bits past the last one)
+                if (bit < nBits) setLabel(i, bit, 1);
             }
         }
+    }
+    free(row);
+
+    return 0;
+}
 
-        lastCh = ch;
-        ch = fgetc(f);
-        if (ferror(f)) ERR_READ();
+int restoreSections(const char* p, const char* end) {
+    int haveColumns = 0;
+    while (p != end) {
+        if (end - p < 12) ERR_TRAIL();
+        uint64_t len = getLE(p + 4);
+        if (len > (uint64_t)(end - p - 12)) ERR_TERM();
+
+        if (memcmp(p, "COLS", 4) == 0 && columnar && !haveColumns) {
+            if (restoreColumns(p + 12, p + 12 + len) != 0) return 1;
+            haveColumns = 1;
+        } else if (memcmp(p, "HASH", 4) == 0) {
+            size_t n = merging ? nMapFiles : nFiles, i;
+            if (len != n * STAMP_SIZE) ERR_TRAIL();
+            // (when merging, files that are already hashed keep their hash)
+            fileStamps = realloc(fileStamps,
+                (nFiles + 1) * sizeof(struct fileStamp));
+            for (i = nFileStamps; i < nFiles; ++i) {
+                fileStamps[i].size = UINT64_MAX;
+            }
+            nFileStamps = nFiles;
+            for (i = 0; i < n; ++i) {
+                struct fileStamp* stamp = &fileStamps[merging ? fileMap[i] : i];
+                if (stamp->size != UINT64_MAX) continue;
+                const char* s = p + 12 + i * STAMP_SIZE;
+                stamp->size = getLE(s);
+                stamp->mtimeSec = getLE(s + 8);
+                stamp->mtimeNsec = getLE(s + 16);
+                stamp->hash = getLE(s + 24);
+            }
+        } else if (memcmp(p, "ORDR", 4) == 0 && !merging) {
+            // (a merged shard's files go wherever they're added, though)
+            if (restoreOrder(p + 12, p + 12 + len) != 0) return 1;
+        }
+        p += 12 + len;
     }
-    categoriesDone:
-    // there's an empty category now that we need to get rid of
-    categories = realloc(categories, (--nCategories) *
-        sizeof(struct ictCategory));
+    if (columnar && !haveColumns) ERR_TERM();
 
     return 0;
 }
 
-int restoreFilenames(FILE* f) {
-    int ch = '\x31', lastCh = '\0', bufLen = 0;
-    char* curStr;
-    while (1) {
-        switch (ch) {
-            case EOF:
-                ERR_TERM();
-            case '\x30':
-                if (lastCh == '\x31') {
-                    if (nFiles > 1) ERR_ZERO();
-                    else {
-                        // there are no files, so just get rid of the empty one
-                        free(curStr);
-                        free(files);
-                        files = NULL;
-                        nFiles = 0;
-                    }
+int restoreColumns(const char* p, const char* end) {
+    size_t n = merging ? nMapFiles : nFiles,
+           nBits = merging ? nMapBits : chkboxCount(), b;
+    for (b = 0; b < nBits; ++b) {
+        if (end - p < 9) ERR_TERM();
+        char kind = p[0];
+        uint64_t len = getLE(p + 1);
+        p += 9;
+        if (len > (uint64_t)(end - p)) ERR_TERM();
+        const char *q = p, *colEnd = p + len;
+        p = colEnd;
+
+        uint64_t file = 0, gap, run;
+        if (kind == COL_ARRAY) {
+            while (q != colEnd) {
+                if (!getVarint(&q, colEnd, &gap) || gap >= n - file) {
+                    ERR_LABELS();
+                }
+                file += gap;
+                restoreLabel(file++, b);
+            }
+        } else if (kind == COL_RUNS) {
+            while (q != colEnd) {
+                if (!getVarint(&q, colEnd, &gap) || gap > n - file ||
+                        !getVarint(&q, colEnd, &run) || run == 0 ||
+                        run > n - file - gap) {
+                    ERR_LABELS();
+                }
+                for (file += gap; run > 0; --run) restoreLabel(file++, b);
+            }
+        } else if (kind == COL_BITMAP) {
+            if (len != (n + 7) / 8) ERR_LABELS();
+            for (; q != colEnd; ++q, file += 8) {
+                unsigned v;
+                for (v = (unsigned char)*q; v != 0; v &= v - 1) {
+                    size_t i = file + __builtin_ctz(v);
+                    if (i >= n) ERR_LABELS();
+                    restoreLabel(i, b);
                 }
-                return 0;
-            case '\x31':
-                if (lastCh == '\x31') ERR_ZERO();
-                // start a new filename
-                curStr = calloc((bufLen = BUF_ADD_SIZE), sizeof(char));
-                files = realloc(files, (++nFiles) * sizeof(struct ictFile));
-                files[nFiles - 1].filename = curStr;
-                files[nFiles - 1].data = 0;
-                break;
-            default:
-                bufLen = addCh(&curStr, ch, bufLen);
-                break;
+            }
+        } else {
+            ERR_LABELS();
         }
+    }
+    if (p != end) ERR_TRAIL();
 
-        lastCh = ch;
-        ch = fgetc(f);
-        if (ferror(f)) ERR_READ();
+    return 0;
+}
+
+int restoreOrder(const char* p, const char* end) {
+    // (every position should come up exactly once)
+    uint64_t* seen = calloc((nFiles + 63) / 64 + 1, sizeof(uint64_t));
+    size_t i;
+    fileAdded = realloc(fileAdded, (nFiles + 1) * sizeof(size_t));
+    for (i = 0; i < nFiles; ++i) {
+        uint64_t pos;
+        if (!getVarint(&p, end, &pos) || pos >= nFiles ||
+                (seen[pos >> 6] >> (pos & 63)) & 1) {
+            free(seen);
+            ERR_ORDER();
+        }
+        seen[pos >> 6] |= (uint64_t)1 << (pos & 63);
+        fileAdded[i] = pos;
     }
+    free(seen);
+    if (p != end) ERR_TRAIL();
+    nFileAdded = nFiles;
 
-    // (we "return 0;" in "case '\x30':" above)
+    return 0;
 }
 
-int restoreFileData(FILE* f) {
-    // figure out how many checkboxes we have and how many chars fit them
-    int i, chkboxCount = 0;
-    for (i = 0; i < nCategories; ++i) chkboxCount += categories[i].nChkboxes;
-    int chars = bitsToChars(chkboxCount);
-    // TODO error if this is more than 8 ^, or handle in some other way
+void restoreLabel(size_t file, size_t bit) {
+    if (merging) setLabel(fileMap[file], bitMap[bit], 1);
+    else setLabel(file, bit, 1);
+}
 
-    char* buf = malloc(chars);
-    for (i = 0; i < nFiles; ++i) {
-        if (fread(buf, sizeof(char), chars, f) != chars) {
-            if (feof(f)) ERR_HEADER();
-            else ERR_READ();
+size_t mergeCategory(const char* name, size_t len) {
+    size_t i;
+    for (i = 0; i < nCategories; ++i) {
+        if (strlen(categories[i].name) == len &&
+                memcmp(categories[i].name, name, len) == 0) return i;
+    }
+    pushCategory(name, len);
+    return nCategories - 1;
+}
+
+void mergeChkbox(size_t categoryIdx, const char* name, size_t len) {
+    struct ictCategory* cat = &categories[categoryIdx];
+    size_t i, bit = categoryFirstBit(categoryIdx);
+    for (i = 0; i < cat->nChkboxes; ++i, ++bit) {
+        if (strlen(cat->chkboxes[i]) == len &&
+                memcmp(cat->chkboxes[i], name, len) == 0) break;
+    }
+    if (i == cat->nChkboxes) {
+        // a new one goes at the end of its category, so all the checkboxes
+        // of later categories move up one
+        pushChkbox(cat, name, len);
+        size_t j;
+        insertLabelColumn(bit);
+        for (j = 0; j < nMapBits; ++j) if (bitMap[j] >= bit) ++bitMap[j];
+    }
+    bitMap = realloc(bitMap, (nMapBits + 1) * sizeof(size_t));
+    bitMap[nMapBits++] = bit;
+}
+
+int mergeFilenames(const char* q, const char* listEnd) {
+    size_t cap = 0, nameCap = 0;
+    char* name = NULL;
+    while (1) {
+        const char* sep = memchr(q, unitSep, listEnd - q);
+        if (sep == NULL) sep = listEnd;
+        if (sep == q) ERR_ZERO();
+
+        if (nameCap < sep - q + 1) {
+            nameCap = sep - q + 1;
+            name = realloc(name, nameCap);
+        }
+        memcpy(name, q, sep - q);
+        name[sep - q] = '\0';
+        ssize_t file = findFile(name);
+        if (nMapFiles == cap) {
+            cap = cap ? cap * 2 : 1024;
+            fileMap = realloc(fileMap, cap * sizeof(size_t));
         }
-        int j;
+        fileMap[nMapFiles++] = file != -1 ? (size_t)file : pushFile(name);
+
+        if (sep == listEnd) break;
+        q = sep + 1;
+    }
+    free(name);
+    return 0;
+}
+
+int mergeFileData(const char** p, const char* end) {
+    // labels are OR'd into whatever's already there
+    size_t i, j, chars = bitsToChars(nMapBits);
+    reserveLabelBits(chkboxCount());
+
+    if ((end - *p) < nMapFiles * chars) ERR_TERM();
+
+    const unsigned char* buf = (const unsigned char*)*p;
+    *p += nMapFiles * chars;
+    for (i = 0; i < nMapFiles; ++i, buf += chars) {
         for (j = 0; j < chars; ++j) {
-            files[i].data <<= 8;
-            files[i].data |= buf[j];
+            size_t byte = chars - 1 - j;
+            unsigned v;
+            for (v = buf[j]; v != 0; v &= v - 1) {
+                size_t bit = byte * 8 + __builtin_ctz(v);
+                if (bit < nMapBits) setLabel(fileMap[i], bitMap[bit], 1);
+            }
         }
     }
-    free(buf);
 
-    if (fgetc(f) != -1) ERR_TRAIL();
+    return 0;
+}
+
+void encodeLE(unsigned char* buf, uint64_t x) {
+    int i;
+    for (i = 0; i < 8; ++i) buf[i] = (x >> (i * 8)) & 0xFF;
+}
+
+void putLE(FILE* f, uint64_t x) {
+    unsigned char buf[8];
+    encodeLE(buf, x);
+    fwrite(buf, sizeof(char), 8, f);
+}
 
+uint64_t getLE(const char* p) {
+    uint64_t x = 0;
+    int i;
+    for (i = 7; i >= 0; --i) x = (x << 8) | (unsigned char)p[i];
+    return x;
+}
+
+// a file's labels are stored most significant byte first, which is its words
+// in reverse order, each big endian, then whatever's left of the top word
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define toBigEndian(w) (w)
+#else
+#define toBigEndian(w) __builtin_bswap64(w)
+#endif
+
+void putRow(unsigned char* buf, const uint64_t* row, size_t chars) {
+    size_t k, j, rest = chars & 7;
+    for (k = 0; k < chars >> 3; ++k) {
+        uint64_t w = toBigEndian(row[k]);
+        memcpy(buf + chars - 8 * (k + 1), &w, 8);
+    }
+    for (j = 0; j < rest; ++j) buf[j] = row[k] >> ((rest - 1 - j) * 8);
+}
+
+void getRow(uint64_t* row, const unsigned char* buf, size_t chars) {
+    size_t k, j, rest = chars & 7;
+    for (k = 0; k < chars >> 3; ++k) {
+        uint64_t w;
+        memcpy(&w, buf + chars - 8 * (k + 1), 8);
+        row[k] = toBigEndian(w);
+    }
+    if (rest == 0) return;
+    row[k] = 0;
+    for (j = 0; j < rest; ++j) {
+        row[k] |= (uint64_t)buf[j] << ((rest - 1 - j) * 8);
+    }
+}
+
+size_t varintLen(uint64_t x) {
+    size_t n = 1;
+    for (; x >= 0x80; x >>= 7) ++n;
+    return n;
+}
+
+size_t putVarint(unsigned char* buf, uint64_t x) {
+    size_t n = 0;
+    for (; x >= 0x80; x >>= 7) buf[n++] = (x & 0x7F) | 0x80;
+    buf[n++] = x;
+    return n;
+}
+
+// returns 0 if it runs past end (or is too long)
+int getVarint(const char** p, const char* end, uint64_t* x) {
+    int shift;
+    *x = 0;
+    for (shift = 0; *p != end && shift < 64; shift += 7) {
+        unsigned char c = *(*p)++;
+        *x |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) return 1;
+    }
     return 0;
 }
 
+char* withSuffix(const char* path, const char* suffix) {
+    char* s = malloc(strlen(path) + strlen(suffix) + 1);
+    sprintf(s, "%s%s", path, suffix);
+    return s;
+}
+
 int bitsToChars(int bits) {
     return ((bits + 7) & (~7)) >> 3;  // oooh fancy bitwise stuffs
 }
@@ -1,7 +1,28 @@
 #ifndef __SAVERESTORE_H__
 #define __SAVERESTORE_H__
 
+// the file labels are saved to: the one given to setSaveFile(), otherwise
+// IMG_SAVE_FILE if that's set, otherwise .imgctool in the current directory
+const char* saveFileName();
+void setSaveFile(const char* path);
+
+// make sure no other imgctool is using the save file (and keep it that way
+// until exit); returns nonzero if one is
+int lockSaveFile();
+
+// save() can run on another thread (see autosave.h): whoever changes
+// categories or labels while it might must hold the state lock, which save()
+// only takes to copy what it's going to write
+void lockState();
+void unlockState();
+
 int save();
 int restore();
 
+// read another save file (a shard, say) on top of what's already restored
+// (refusing to if another imgctool has it open):
+// its categories, checkboxes and files are matched up with ours by name
+// (adding any that are new), and its labels OR'd into ours
+int restoreMerge(const char* path);
+
 #endif
@@ -0,0 +1,89 @@
+#include "stats.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ictdata.h"
+
+size_t* chkboxCounts = NULL;
+size_t nUnlabeled = 0;
+uint64_t* labeledFiles = NULL;
+
+// checkboxes when statsRecount() last ran (plus those added and removed
+// since), and how many of them each file has checked
+static size_t nBits = 0;
+static uint32_t* fileCounts = NULL;
+
+void statsRecount() {
+    size_t file, bit, w, words = (nFiles + 63) >> 6;
+    nBits = chkboxCount();
+    chkboxCounts = realloc(chkboxCounts, (nBits + 1) * sizeof(size_t));
+    fileCounts = realloc(fileCounts, (nFiles + 1) * sizeof(uint32_t));
+    memset(fileCounts, 0, (nFiles + 1) * sizeof(uint32_t));
+
+    for (bit = 0; bit < nBits; ++bit) {
+        const uint64_t* col = labelColumns[bit];
+        size_t count = 0;
+        for (w = 0; w < words; ++w) {
+            uint64_t x = col[w];
+            count += __builtin_popcountll(x);
+            // (most columns are sparse, so just visit the set bits)
+            while (x != 0) {
+                ++fileCounts[(w << 6) | __builtin_ctzll(x)];
+                x &= x - 1;
+            }
+        }
+        chkboxCounts[bit] = count;
+    }
+
+    labeledFiles = realloc(labeledFiles, (words + 1) * sizeof(uint64_t));
+    memset(labeledFiles, 0, (words + 1) * sizeof(uint64_t));
+    nUnlabeled = 0;
+    for (file = 0; file < nFiles; ++file) {
+        if (fileCounts[file] == 0) ++nUnlabeled;
+        else labeledFiles[file >> 6] |= (uint64_t)1 << (file & 63);
+    }
+}
+
+void statsLabelChanged(size_t file, size_t bit, int value) {
+    // the file's first label, or its last one going away
+    if (value) {
+        ++chkboxCounts[bit];
+        if (fileCounts[file]++ == 0) {
+            --nUnlabeled;
+            labeledFiles[file >> 6] |= (uint64_t)1 << (file & 63);
+        }
+    } else {
+        --chkboxCounts[bit];
+        if (--fileCounts[file] == 0) {
+            ++nUnlabeled;
+            labeledFiles[file >> 6] &= ~((uint64_t)1 << (file & 63));
+        }
+    }
+}
+
+void statsChkboxAdded(size_t bit) {
+    chkboxCounts = realloc(chkboxCounts, (nBits + 2) * sizeof(size_t));
+    memmove(chkboxCounts + bit + 1, chkboxCounts + bit,
+        (nBits - bit) * sizeof(size_t));
+    chkboxCounts[bit] = 0;
+    ++nBits;
+}
+
+void statsChkboxDeleted(size_t bit) {
+    const uint64_t* col = labelColumns[bit];
+    size_t w, words = (nFiles + 63) >> 6;
+    for (w = 0; w < words; ++w) {
+        uint64_t x;
+        for (x = col[w]; x != 0; x &= x - 1) {
+            size_t i = __builtin_ctzll(x);
+            if (--fileCounts[(w << 6) | i] == 0) {
+                ++nUnlabeled;
+                labeledFiles[w] &= ~((uint64_t)1 << i);
+            }
+        }
+    }
+    memmove(chkboxCounts + bit, chkboxCounts + bit + 1,
+        (nBits - bit - 1) * sizeof(size_t));
+    --nBits;
+}
@@ -0,0 +1,31 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// how many files have each checkbox checked (indexed like the label bits),
+// and how many have none checked at all
+extern size_t* chkboxCounts;
+extern size_t nUnlabeled;
+
+// the files with at least one checkbox checked, file i being bit i % 64 of
+// word i / 64 (as in the label columns); for finding unlabeled files without
+// looking at every column
+extern uint64_t* labeledFiles;
+
+// count everything from scratch (once the files and labels are loaded)
+void statsRecount();
+
+// checkbox `bit' of file `file' was just changed to `value'
+// O(1): a count of checked boxes is kept for every file
+void statsLabelChanged(size_t file, size_t bit, int value);
+
+// an empty checkbox was added at `bit' (after its column was)
+void statsChkboxAdded(size_t bit);
+
+// the checkbox at `bit' is about to be deleted (before its column is); only
+// its own column is looked at
+void statsChkboxDeleted(size_t bit);
+
+#endif
@@ -0,0 +1,558 @@
+#include "suggest.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ictdata.h"
+#include "image.h"
+#include "stats.h"
+#include "dedupe.h"
+#include "saverestore.h"
+#include "trace.h"
+
+// every file is shrunk to THUMB x THUMB pixels, and how alike two files look
+// is the sum of the absolute differences between their thumbnails' bytes
+static const int THUMB = 8;
+static const size_t FEATURE_SIZE = 8 * 8 * 3;  // THUMB * THUMB pixels, RGB
+static const int MAX_NEIGHBORS = 64;
+
+// the cache: "ICTF" and a version byte, then for every thumbnail the length
+// of the file's name, the file's size and mtime (seconds, nanoseconds) when
+// it was made as little-endian uint64s, the name and the thumbnail
+// a file that couldn't be decoded gets a record too, with the top bit of the
+// name length set (and a zeroed thumbnail), so it isn't tried again until it
+// changes
+// new thumbnails are appended as they're made; later ones win, and the file
+// is rewritten with just the latest of each when it's mostly stale
+// it's looked up by a hash of the name, and a file's thumbnail is only read
+// out of it once a worker gets to that file: matching the names up with
+// files[] at startup would mean loading every name (see pushLazyFiles())
+static const char CACHE_SUFFIX[] = ".features";
+static const char CACHE_HEADER[] = "ICTF\x02";
+static const size_t HEADER_SIZE = 5;
+static const size_t MAX_NAME = 1 << 16;
+static const uint64_t UNDECODABLE = (uint64_t)1 << 63;
+
+// how far along each file's thumbnail is (atomic)
+enum { THUMB_TODO, THUMB_BUSY, THUMB_READY, THUMB_FAILED };
+static unsigned char* states = NULL;
+static unsigned char* features = NULL;  // FEATURE_SIZE bytes per file
+
+// a file's size and mtime, which have to match for a cached thumbnail to be
+// used
+struct stamp {
+    uint64_t size, mtimeSec, mtimeNsec;
+};
+
+// the latest thumbnail in the cache for each name (by a 64-bit hash of it,
+// which is as good as the name itself for a few million names), and an open
+// addressing index into them (holding i + 1 for cached[i], 0 when empty);
+// read-only once the workers start
+static struct cached {
+    uint64_t nameHash;
+    struct stamp stamp;
+    uint64_t offset;  // of the thumbnail in the cache
+    int failed;       // (the file couldn't be decoded)
+}* cached = NULL;
+static size_t nCached = 0, cachedCap = 0;
+static size_t* cachedIndex = NULL;
+static size_t cachedMask = 0;
+static int cacheFd = -1;  // (for reading thumbnails back)
+
+static const size_t NONE = (size_t)-1;
+
+static int nNeighbors = 0, running = 0;
+static pthread_t* threads = NULL;
+static long nThreads = 0;
+static size_t hint = (size_t)-1;  // (atomic) the file to make next
+static size_t nextChunk = 0;      // (atomic)
+static int quitting = 0;          // (atomic)
+
+// the search thread finds the nearest labeled files to the one being shown,
+// so the interface never waits on a scan of every labeled file (or on the
+// thumbnail it needs); it's asked for one file at a time, and a newer
+// question makes it drop whatever it was doing
+static pthread_t searcher;
+static pthread_mutex_t searchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t searchWake = PTHREAD_COND_INITIALIZER;
+// all protected by searchLock (asked is atomic, too)
+static size_t asked = (size_t)-1, answered = (size_t)-1;
+static uint64_t* askedLabeled = NULL;  // labeledFiles when it was asked
+static size_t* answer = NULL;          // the nearest files, nearest first
+static unsigned* answerDists = NULL;
+static size_t nAnswer = 0;
+
+// what the interface has of the answer for the file it's showing
+static size_t shownFile = (size_t)-1;
+static int haveNearest = 0;
+static size_t* nearest = NULL;
+static unsigned* dists = NULL;
+static size_t nNearest = 0;
+
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* cache = NULL;  // protected by cacheLock
+
+// the suggestions for the file last passed to suggestUpdate(), one per bit
+static unsigned char* suggestions = NULL;
+static size_t nSuggestions = 0;
+
+static void putLE(unsigned char* p, uint64_t x) {
+    int i;
+    for (i = 0; i < 8; ++i) p[i] = x >> (8 * i);
+}
+
+static uint64_t getLE(const unsigned char* p) {
+    uint64_t x = 0;
+    int i;
+    for (i = 7; i >= 0; --i) x = (x << 8) | p[i];
+    return x;
+}
+
+static uint64_t hashName(const char* name, size_t len) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        h = (h ^ (unsigned char)name[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+static struct cached* cacheFind(uint64_t nameHash) {
+    if (cachedIndex == NULL) return NULL;
+    size_t i;
+    for (i = nameHash & cachedMask; cachedIndex[i] != 0;
+            i = (i + 1) & cachedMask) {
+        if (cached[cachedIndex[i] - 1].nameHash == nameHash) {
+            return &cached[cachedIndex[i] - 1];
+        }
+    }
+    return NULL;
+}
+
+// remember a thumbnail read from the cache (replacing any earlier one for the
+// same name)
+static void cacheAdd(const struct cached* c) {
+    struct cached* old = cacheFind(c->nameHash);
+    if (old != NULL) {
+        *old = *c;
+        return;
+    }
+    if (nCached == cachedCap) {
+        cachedCap = cachedCap ? cachedCap * 2 : 1024;
+        cached = realloc(cached, cachedCap * sizeof(struct cached));
+        // (kept at most half full)
+        free(cachedIndex);
+        cachedMask = 2 * cachedCap - 1;
+        cachedIndex = calloc(cachedMask + 1, sizeof(size_t));
+        size_t j, i;
+        for (j = 0; j < nCached; ++j) {
+            for (i = cached[j].nameHash & cachedMask; cachedIndex[i] != 0;
+                    i = (i + 1) & cachedMask);
+            cachedIndex[i] = j + 1;
+        }
+    }
+    cached[nCached] = *c;
+    size_t i;
+    for (i = c->nameHash & cachedMask; cachedIndex[i] != 0;
+            i = (i + 1) & cachedMask);
+    cachedIndex[i] = ++nCached;
+}
+
+static void writeRecord(FILE* f, const char* name, size_t len,
+        const struct stamp* st, const unsigned char* feature, int failed) {
+    unsigned char head[4 * 8];
+    putLE(head, failed ? len | UNDECODABLE : len);
+    putLE(head + 8, st->size);
+    putLE(head + 16, st->mtimeSec);
+    putLE(head + 24, st->mtimeNsec);
+    fwrite(head, 1, sizeof(head), f);
+    fwrite(name, 1, len, f);
+    fwrite(feature, 1, FEATURE_SIZE, f);
+}
+
+// go through the records in the cache f (just past its header), calling
+// found() with each one, its name and where its thumbnail is; returns where
+// the last complete record ends
+static long readRecords(FILE* f, char* name, unsigned char* feature,
+        void (*found)(const struct cached* c, const char* name, size_t len,
+            const unsigned char* feature)) {
+    unsigned char head[4 * 8];
+    long good = ftell(f);
+    while (fread(head, 1, sizeof(head), f) == sizeof(head)) {
+        uint64_t len = getLE(head) & ~UNDECODABLE;
+        if (len == 0 || len > MAX_NAME || fread(name, 1, len, f) != len) break;
+        struct cached c = {hashName(name, len),
+            {getLE(head + 8), getLE(head + 16), getLE(head + 24)}, ftell(f),
+            (getLE(head) & UNDECODABLE) != 0};
+        if (fread(feature, 1, FEATURE_SIZE, f) != FEATURE_SIZE) break;
+        good = ftell(f);
+        found(&c, name, len, feature);
+    }
+    return good;
+}
+
+static size_t nRecords = 0;
+
+static void foundRecord(const struct cached* c, const char* name, size_t len,
+        const unsigned char* feature) {
+    ++nRecords;
+    cacheAdd(c);
+}
+
+// (while rewriting the cache into `cache')
+static void keepRecord(const struct cached* c, const char* name, size_t len,
+        const unsigned char* feature) {
+    struct cached* latest = cacheFind(c->nameHash);
+    if (latest->offset != c->offset) return;
+    latest->offset = ftell(cache) + 4 * 8 + len;
+    writeRecord(cache, name, len, &c->stamp, feature, c->failed);
+}
+
+// read what's in the cache, then open it for appending (rewriting it first if
+// most of it is stale, or starting over if it's damaged)
+static void openCache() {
+    char* path = malloc(strlen(saveFileName()) + sizeof(CACHE_SUFFIX));
+    sprintf(path, "%s%s", saveFileName(), CACHE_SUFFIX);
+    char* name = malloc(MAX_NAME + 1);
+    unsigned char* feature = malloc(FEATURE_SIZE);
+    long good = 0;  // (where the last complete record ends)
+
+    unsigned char head[HEADER_SIZE];
+    FILE* f = fopen(path, "rb");
+    if (f != NULL && fread(head, 1, HEADER_SIZE, f) == HEADER_SIZE &&
+            memcmp(head, CACHE_HEADER, HEADER_SIZE) == 0) {
+        good = readRecords(f, name, feature, foundRecord);
+    }
+
+    if (good == 0) {
+        nCached = 0;
+        free(cachedIndex);
+        cachedIndex = NULL;
+        cache = fopen(path, "wb");
+        if (cache != NULL) fwrite(CACHE_HEADER, 1, HEADER_SIZE, cache);
+    } else if (nRecords > 2 * nCached + 1024) {
+        // copy just the latest of each over, then put it in place
+        char* tmp = malloc(strlen(path) + 5);
+        sprintf(tmp, "%s.tmp", path);
+        cache = fopen(tmp, "wb");
+        if (cache != NULL) {
+            fwrite(CACHE_HEADER, 1, HEADER_SIZE, cache);
+            fseek(f, HEADER_SIZE, SEEK_SET);
+            readRecords(f, name, feature, keepRecord);
+            if (fflush(cache) != 0 || rename(tmp, path) != 0) {
+                fclose(cache);
+                cache = NULL;
+                unlink(tmp);
+            }
+        }
+        free(tmp);
+    } else {
+        // (dropping anything half-written at the end)
+        if (truncate(path, good) == 0) cache = fopen(path, "ab");
+    }
+    if (f != NULL) fclose(f);
+    if (cache == NULL) {
+        nCached = 0;  // (the offsets may be out of date)
+    } else {
+        cacheFd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+
+    free(feature);
+    free(name);
+    free(path);
+}
+
+// make a file's thumbnail, unless the cached one is still good
+static void makeThumb(size_t file) {
+    const char* name = fileName(file);
+    size_t len = strlen(name);
+    struct stat st;
+    struct image img, small;
+    if (stat(name, &st) != 0) {
+        __atomic_store_n(&states[file], THUMB_FAILED, __ATOMIC_RELEASE);
+        return;
+    }
+    struct stamp now = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    unsigned char* feature = features + file * FEATURE_SIZE;
+    const struct cached* c = nCached ? cacheFind(hashName(name, len)) : NULL;
+    if (c != NULL && memcmp(&now, &c->stamp, sizeof(now)) == 0) {
+        if (c->failed) {
+            __atomic_store_n(&states[file], THUMB_FAILED, __ATOMIC_RELEASE);
+            return;
+        }
+        if (pread(cacheFd, feature, FEATURE_SIZE, c->offset) ==
+                (ssize_t)FEATURE_SIZE) {
+            __atomic_store_n(&states[file], THUMB_READY, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+
+    int failed = imageLoad(name, &img) != 0;
+    if (failed) {
+        memset(feature, 0, FEATURE_SIZE);
+    } else {
+        imageScale(&img, &small, THUMB, THUMB);
+        imageFree(&img);
+        memcpy(feature, small.rgb, FEATURE_SIZE);
+        imageFree(&small);
+    }
+    __atomic_store_n(&states[file], failed ? THUMB_FAILED : THUMB_READY,
+        __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&cacheLock);
+    if (cache != NULL) writeRecord(cache, name, len, &now, feature, failed);
+    pthread_mutex_unlock(&cacheLock);
+}
+
+// make a file's thumbnail if nobody else has started on it
+static void claim(size_t file) {
+    unsigned char s = THUMB_TODO;
+    if (__atomic_compare_exchange_n(&states[file], &s, THUMB_BUSY, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        makeThumb(file);
+    }
+}
+
+// the threads take files in chunks of this many (but the file being shown
+// always goes first)
+static const size_t CHUNK = 64;
+
+static void* worker(void* arg) {
+    size_t start, i;
+    while ((start = __atomic_fetch_add(&nextChunk, CHUNK, __ATOMIC_RELAXED))
+            < nFiles) {
+        for (i = start; i < start + CHUNK && i < nFiles; ++i) {
+            if (__atomic_load_n(&quitting, __ATOMIC_RELAXED)) return NULL;
+            size_t h = __atomic_load_n(&hint, __ATOMIC_RELAXED);
+            if (h < nFiles) claim(h);
+            claim(i);
+        }
+    }
+    return NULL;
+}
+
+// sum of absolute differences between two thumbnails
+static unsigned distance(const unsigned char* a, const unsigned char* b) {
+    size_t i;
+#ifdef __SSE2__
+    // (16 bytes at a time, into two 64-bit sums)
+    __m128i sum = _mm_setzero_si128();
+    for (i = 0; i < FEATURE_SIZE; i += 16) {
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(
+            _mm_loadu_si128((const __m128i*)(a + i)),
+            _mm_loadu_si128((const __m128i*)(b + i))));
+    }
+    return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#else
+    unsigned sum = 0;
+    for (i = 0; i < FEATURE_SIZE; ++i) sum += abs(a[i] - b[i]);
+    return sum;
+#endif
+}
+
+// whether the interface has moved on from the file being searched for
+static int superseded() {
+    return __atomic_load_n(&asked, __ATOMIC_RELAXED) != NONE ||
+        __atomic_load_n(&quitting, __ATOMIC_RELAXED);
+}
+
+// the nearest labeled files to `file' (not counting the file itself or its
+// copies, which share its labels anyway) into near[] and d[], nearest first;
+// returns how many, or -1 if it was superseded first
+static ssize_t search(size_t file, const uint64_t* labeled, size_t* near,
+        unsigned* d) {
+    // (the workers make the file being shown first, but it may not be done)
+    claim(file);
+    unsigned char s;
+    while ((s = __atomic_load_n(&states[file], __ATOMIC_ACQUIRE)) ==
+            THUMB_BUSY) {
+        if (superseded()) return -1;
+        usleep(1000);
+    }
+    if (s != THUMB_READY) return 0;
+
+    uint64_t t = traceBegin();
+    size_t n = 0, i, w, words = (nFiles + 63) >> 6;
+    const unsigned char* mine = features + file * FEATURE_SIZE;
+    for (w = 0; w < words; ++w) {
+        if ((w & 1023) == 0 && superseded()) return -1;
+        uint64_t x;
+        for (x = labeled[w]; x != 0; x &= x - 1) {
+            size_t f = (w << 6) | __builtin_ctzll(x);
+            if (dupFirst(f) == dupFirst(file) ||
+                    __atomic_load_n(&states[f], __ATOMIC_ACQUIRE) !=
+                    THUMB_READY) {
+                continue;
+            }
+            unsigned dist = distance(mine, features + f * FEATURE_SIZE);
+            if (n == (size_t)nNeighbors && dist >= d[n - 1]) continue;
+            if (n < (size_t)nNeighbors) ++n;
+            for (i = n - 1; i > 0 && d[i - 1] > dist; --i) {
+                near[i] = near[i - 1];
+                d[i] = d[i - 1];
+            }
+            near[i] = f;
+            d[i] = dist;
+        }
+    }
+    traceEnd(TRACE_SUGGEST, t, 0);
+    return n;
+}
+
+static void* searchThread(void* arg) {
+    uint64_t* labeled = malloc((((nFiles + 63) >> 6) + 1) * sizeof(uint64_t));
+    size_t* near = malloc(nNeighbors * sizeof(size_t));
+    unsigned* d = malloc(nNeighbors * sizeof(unsigned));
+
+    pthread_mutex_lock(&searchLock);
+    while (1) {
+        while (asked == NONE && !__atomic_load_n(&quitting, __ATOMIC_RELAXED)) {
+            pthread_cond_wait(&searchWake, &searchLock);
+        }
+        if (__atomic_load_n(&quitting, __ATOMIC_RELAXED)) break;
+        size_t file = asked;
+        __atomic_store_n(&asked, NONE, __ATOMIC_RELAXED);
+        uint64_t* tmp = labeled;
+        labeled = askedLabeled;
+        askedLabeled = tmp;
+        pthread_mutex_unlock(&searchLock);
+
+        ssize_t n = search(file, labeled, near, d);
+
+        pthread_mutex_lock(&searchLock);
+        // (unless it was asked something else in the meantime)
+        if (n >= 0 && asked == NONE) {
+            answered = file;
+            nAnswer = n;
+            memcpy(answer, near, n * sizeof(size_t));
+            memcpy(answerDists, d, n * sizeof(unsigned));
+        }
+    }
+    pthread_mutex_unlock(&searchLock);
+
+    free(labeled);
+    free(near);
+    free(d);
+    return NULL;
+}
+
+void suggestInit() {
+    char* env = getenv("IMG_SUGGEST");
+    nNeighbors = env != NULL ? atoi(env) : 0;
+    if (nNeighbors <= 0) return;
+    if (nNeighbors > MAX_NEIGHBORS) nNeighbors = MAX_NEIGHBORS;
+
+    states = calloc(nFiles + 1, 1);
+    features = malloc((nFiles + 1) * FEATURE_SIZE);
+    nearest = malloc(nNeighbors * sizeof(size_t));
+    dists = malloc(nNeighbors * sizeof(unsigned));
+    answer = malloc(nNeighbors * sizeof(size_t));
+    answerDists = malloc(nNeighbors * sizeof(unsigned));
+    askedLabeled = malloc((((nFiles + 63) >> 6) + 1) * sizeof(uint64_t));
+    openCache();
+
+    if (pthread_create(&searcher, NULL, searchThread, NULL) != 0) return;
+    char* threadsEnv = getenv("IMG_THREADS");
+    nThreads = threadsEnv != NULL ? atol(threadsEnv) :
+        sysconf(_SC_NPROCESSORS_ONLN);
+    if (nThreads < 1) nThreads = 1;
+    threads = malloc(nThreads * sizeof(pthread_t));
+    long i;
+    for (i = 0; i < nThreads; ++i) {
+        if (pthread_create(&threads[i], NULL, worker, NULL) != 0) break;
+    }
+    nThreads = i;
+    running = 1;
+}
+
+// work out the suggestions from the nearest files found for the one shown
+static void vote() {
+    size_t nBits = chkboxCount(), bit, i;
+    suggestions = realloc(suggestions, nBits + 1);
+    nSuggestions = nBits;
+
+    // suggest whatever most of them have checked, the nearer ones counting
+    // for more (so a few far-off files can't outvote a close match)
+    double total = 0;
+    for (i = 0; i < nNearest; ++i) total += 1.0 / (1 + dists[i]);
+    for (bit = 0; bit < nBits; ++bit) {
+        double votes = 0;
+        for (i = 0; i < nNearest; ++i) {
+            if (getLabel(nearest[i], bit)) votes += 1.0 / (1 + dists[i]);
+        }
+        suggestions[bit] = nNearest > 0 && votes * 2 > total;
+    }
+}
+
+int suggestUpdate(size_t file) {
+    if (!running) return 0;
+    if (file == shownFile) {
+        // (the checkboxes changed, not the file)
+        if (!haveNearest) return 1;
+        vote();
+        return 0;
+    }
+
+    shownFile = file;
+    haveNearest = 0;
+    nSuggestions = 0;
+    __atomic_store_n(&hint, file, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&searchLock);
+    memcpy(askedLabeled, labeledFiles,
+        ((nFiles + 63) >> 6) * sizeof(uint64_t));
+    // (an answer for this file from an earlier visit is out of date)
+    answered = NONE;
+    __atomic_store_n(&asked, file, __ATOMIC_RELAXED);
+    pthread_cond_signal(&searchWake);
+    pthread_mutex_unlock(&searchLock);
+    return 1;
+}
+
+int suggestPoll() {
+    if (!running || haveNearest) return 0;
+    pthread_mutex_lock(&searchLock);
+    int done = answered == shownFile;
+    if (done) {
+        nNearest = nAnswer;
+        memcpy(nearest, answer, nAnswer * sizeof(size_t));
+        memcpy(dists, answerDists, nAnswer * sizeof(unsigned));
+        answered = NONE;
+    }
+    pthread_mutex_unlock(&searchLock);
+    if (!done) return 1;
+
+    haveNearest = 1;
+    vote();
+    return 0;
+}
+
+int suggested(size_t bit) {
+    return bit < nSuggestions && suggestions[bit];
+}
+
+void suggestQuit() {
+    if (!running) return;
+    pthread_mutex_lock(&searchLock);
+    __atomic_store_n(&quitting, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&searchWake);
+    pthread_mutex_unlock(&searchLock);
+    long i;
+    for (i = 0; i < nThreads; ++i) pthread_join(threads[i], NULL);
+    pthread_join(searcher, NULL);
+    free(threads);
+    if (cache != NULL) fclose(cache);
+    cache = NULL;
+    if (cacheFd != -1) close(cacheFd);
+    cacheFd = -1;
+    running = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef __SUGGEST_H__
+#define __SUGGEST_H__
+
+#include <stddef.h>
+
+// suggesting labels for a file from the labeled files that look most like it
+// with IMG_SUGGEST=K, worker threads (IMG_THREADS of them) shrink every file
+// to a tiny thumbnail in the background (decoding it like the built-in viewer
+// does, see image.h), and the checkboxes checked on most of a file's K
+// nearest labeled neighbors are suggested for it
+// thumbnails are cached next to the save file (with a .features suffix), so
+// later sessions only make them for new or changed files
+
+// load the cache and start the worker threads, if IMG_SUGGEST is set
+void suggestInit();
+
+// start working out the suggestions for `file' (with the state locked, see
+// saverestore.h): its nearest labeled neighbors are found on another thread
+// (once its thumbnail is made, which happens next), so this returns nonzero
+// until suggestPoll() says they're in; called again for the same file (say,
+// after checkboxes were added), it just recounts the neighbors' votes
+int suggestUpdate(size_t file);
+
+// whether the suggestions for the file last passed to suggestUpdate() are
+// still being worked out (with the state locked); returns 0 once they're in
+int suggestPoll();
+
+// whether checkbox `bit' is suggested for the file last passed to
+// suggestUpdate()
+int suggested(size_t bit);
+
+// stop the worker threads, and finish writing the cache
+void suggestQuit();
+
+#endif
@@ -0,0 +1,164 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char* SPAN_NAMES[] = {
+    "key", "poll", "updateMainWin", "updateFileWin", "updateStatsWin",
+    "updateImage", "save", "suggestSearch"
+};
+
+// histograms are log-linear, like HdrHistogram's: values below 2^SUB_BITS
+// get a bucket each, and every power of 2 above that is split into
+// 2^SUB_BITS buckets, so a bucket is never more than ~3% wide
+#define SUB_BITS 5
+#define SUB (1 << SUB_BITS)
+#define N_BUCKETS ((64 - SUB_BITS + 1) * SUB)
+
+// past this many, events only go into the histograms (~24M of memory)
+static const size_t MAX_EVENTS = 1 << 20;
+
+struct event {
+    uint64_t start, dur;
+    int span, tid, arg;
+};
+
+static int enabled = 0;
+static char* tracePath = NULL;
+static uint64_t epoch;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// all protected by lock
+static uint64_t buckets[TRACE_SPANS][N_BUCKETS];
+static uint64_t counts[TRACE_SPANS], totals[TRACE_SPANS], maxes[TRACE_SPANS];
+static struct event* events = NULL;
+static size_t nEvents = 0, eventsCap = 0, dropped = 0;
+static int nThreads = 0;
+
+// small per-thread number for the trace file (0 until first used)
+static _Thread_local int threadId = 0;
+
+static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bucketOf(uint64_t v) {
+    if (v < SUB) return v;
+    int msb = 63 - __builtin_clzll(v);
+    return (msb - SUB_BITS + 1) * SUB + (v >> (msb - SUB_BITS)) - SUB;
+}
+
+// largest value that lands in bucket b
+static uint64_t bucketHigh(int b) {
+    if (b < SUB) return b;
+    int shift = b / SUB - 1;
+    uint64_t sub = b % SUB + SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+void traceInit() {
+    char* val = getenv("IMG_TRACE");
+    if (val == NULL || *val == '\0' || strcmp(val, "0") == 0) return;
+    enabled = 1;
+    if (strcmp(val, "1") != 0) tracePath = val;
+    epoch = now();
+}
+
+uint64_t traceBegin() {
+    return enabled ? now() : 0;
+}
+
+void traceEnd(enum traceSpan span, uint64_t start, int arg) {
+    if (!enabled || start == 0) return;
+    uint64_t dur = now() - start;
+
+    pthread_mutex_lock(&lock);
+    ++buckets[span][bucketOf(dur)];
+    ++counts[span];
+    totals[span] += dur;
+    if (dur > maxes[span]) maxes[span] = dur;
+
+    if (tracePath != NULL) {
+        if (threadId == 0) threadId = ++nThreads;
+        if (nEvents == MAX_EVENTS) {
+            ++dropped;
+        } else {
+            if (nEvents == eventsCap) {
+                eventsCap = eventsCap ? eventsCap * 2 : 4096;
+                events = realloc(events, eventsCap * sizeof(struct event));
+            }
+            struct event e = {start - epoch, dur, span, threadId, arg};
+            events[nEvents++] = e;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// value at or below which fraction p of span's samples are
+static uint64_t percentile(int span, double p) {
+    uint64_t target = p * counts[span] + 0.5, seen = 0;
+    int b;
+    if (target == 0) target = 1;
+    for (b = 0; b < N_BUCKETS; ++b) {
+        seen += buckets[span][b];
+        if (seen >= target) break;
+    }
+    uint64_t high = bucketHigh(b);
+    return high < maxes[span] ? high : maxes[span];
+}
+
+static void writeTrace() {
+    FILE* f = fopen(tracePath, "w");
+    if (f == NULL) {
+        fprintf(stderr, "error writing to file %s\n", tracePath);
+        return;
+    }
+    size_t i;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+    for (i = 0; i < nEvents; ++i) {
+        const struct event* e = &events[i];
+        // (Chrome trace timestamps are in microseconds)
+        fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f", i ? ",\n" : "", SPAN_NAMES[e->span],
+            e->tid, e->start / 1e3, e->dur / 1e3);
+        if (e->span == TRACE_KEY) fprintf(f, ",\"args\":{\"key\":%d}", e->arg);
+        fputc('}', f);
+    }
+    fputs("\n]}\n", f);
+    if (fclose(f) != 0) fprintf(stderr, "error writing to file %s\n", tracePath);
+}
+
+void traceQuit() {
+    if (!enabled) return;
+    pthread_mutex_lock(&lock);
+
+    int span;
+    fprintf(stderr, "%-15s %8s %10s %10s %10s %10s %10s %10s\n", "latency (us)",
+        "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (span = 0; span < TRACE_SPANS; ++span) {
+        if (counts[span] == 0) continue;
+        fprintf(stderr, "%-15s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f "
+            "%10.1f\n", SPAN_NAMES[span], (unsigned long long)counts[span],
+            totals[span] / 1e3 / counts[span], percentile(span, 0.5) / 1e3,
+            percentile(span, 0.9) / 1e3, percentile(span, 0.99) / 1e3,
+            percentile(span, 0.999) / 1e3, maxes[span] / 1e3);
+    }
+
+    if (tracePath != NULL) {
+        writeTrace();
+        if (dropped) {
+            fprintf(stderr, "(%zu events past the first %zu are only in the "
+                "summary)\n", dropped, MAX_EVENTS);
+        }
+    }
+    free(events);
+    events = NULL;
+    nEvents = eventsCap = 0;
+    enabled = 0;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,35 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+// opt-in latency tracing: with IMG_TRACE set, how long each of these takes is
+// kept in a histogram, and a summary (count, mean, percentiles and max of
+// each) is printed to stderr by traceQuit(); if IMG_TRACE is a path rather
+// than just "1", every event is also written there as a Chrome trace (JSON
+// that chrome://tracing and Perfetto can open)
+enum traceSpan {
+    TRACE_KEY,         // handling one key, up to and including repainting
+    TRACE_POLL,        // checking for (and drawing) a rendered preview
+    TRACE_MAIN_WIN,    // updateMainWin()
+    TRACE_FILE_WIN,    // updateFileWin()
+    TRACE_STATS_WIN,   // updateStatsWin()
+    TRACE_IMAGE,       // updateImage(): starting the viewer or a render
+    TRACE_SAVE,        // save(), on whichever thread
+    TRACE_SUGGEST,     // finding the nearest labeled files (see suggest.h)
+    TRACE_SPANS
+};
+
+void traceInit();
+
+// current time, to be passed to traceEnd() later (0 if tracing is off)
+uint64_t traceBegin();
+
+// a span that started at `start' just ended; `arg' is the key for TRACE_KEY
+// and ignored otherwise
+void traceEnd(enum traceSpan span, uint64_t start, int arg);
+
+// print the summary and write the trace file (if any)
+void traceQuit();
+
+#endif
@@ -0,0 +1,129 @@
+#include "viewer.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// the viewer command, split on spaces, with room for the filename and a NULL
+static char** viewerArgv = NULL;
+static int viewerArgc = 0;
+
+static pid_t viewerPid = -1;  // last viewer we spawned, if any
+static int serverFd = -1;     // stdin of the IMG_VIEWER_SERVER process
+
+// fork and exec argv (or `sh -c cmd' if cmd isn't NULL) with output going to
+// /dev/null; if stdinFd isn't -1, it becomes the child's stdin
+// the child leads its own process group, so stop() gets the real viewer too
+// and not just the shell running it (or whatever else it started)
+static pid_t spawn(char** argv, const char* cmd, int stdinFd) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        // (in both, so it's done whichever runs first)
+        if (pid != -1) setpgid(pid, pid);
+        return pid;
+    }
+
+    // child
+    setpgid(0, 0);
+    int devNull = open("/dev/null", O_RDWR);
+    dup2(stdinFd == -1 ? devNull : stdinFd, 0);
+    dup2(devNull, 1);
+    dup2(devNull, 2);
+    if (cmd != NULL) execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+    else execvp(argv[0], argv);
+    _exit(127);
+}
+
+// ask a viewer (and everything in its process group) to exit
+static void stop(pid_t pid) {
+    kill(-pid, SIGTERM);
+}
+
+// collect any children that have exited
+static void reap() {
+    while (waitpid(-1, NULL, WNOHANG) > 0);
+}
+
+static void startServer(const char* cmd) {
+    int fds[2];
+    if (pipe(fds) != 0) return;
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = spawn(NULL, cmd, fds[0]);
+    close(fds[0]);
+    if (pid == -1) {
+        close(fds[1]);
+        return;
+    }
+    viewerPid = pid;
+    serverFd = fds[1];
+}
+
+static void stopServer() {
+    close(serverFd);
+    serverFd = -1;
+    stop(viewerPid);
+    viewerPid = -1;
+    reap();
+}
+
+void viewerInit(const char* viewer) {
+    // a dead server shouldn't kill us; writes to it fail with EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
+
+    char* words = malloc(strlen(viewer) + 1);
+    strcpy(words, viewer);
+    char* word;
+    for (word = strtok(words, " \t"); word != NULL;
+            word = strtok(NULL, " \t")) {
+        // (+ room for the filename and NULL in viewerShow())
+        viewerArgv = realloc(viewerArgv, (viewerArgc + 3) * sizeof(char*));
+        viewerArgv[viewerArgc++] = word;
+    }
+    if (viewerArgc == 0) {
+        // (shouldn't happen, main() checked the viewer exists)
+        viewerArgv = malloc(3 * sizeof(char*));
+        viewerArgv[viewerArgc++] = "display";
+    }
+
+    char* server = getenv("IMG_VIEWER_SERVER");
+    if (server != NULL && *server != '\0') startServer(server);
+}
+
+void viewerShow(const char* filename) {
+    if (serverFd != -1) {
+        size_t len = strlen(filename), off = 0;
+        char* line = malloc(len + 1);
+        memcpy(line, filename, len);
+        line[len++] = '\n';
+        while (off < len) {
+            ssize_t n = write(serverFd, line + off, len - off);
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) break;
+            off += n;
+        }
+        free(line);
+        if (off == len) return;
+        // the server went away; fall back to spawning a viewer per image
+        stopServer();
+    }
+
+    // replace the previous viewer with a new one
+    if (viewerPid != -1) stop(viewerPid);
+    reap();
+    viewerArgv[viewerArgc] = (char*)filename;
+    viewerArgv[viewerArgc + 1] = NULL;
+    viewerPid = spawn(viewerArgv, NULL, -1);
+}
+
+void viewerQuit() {
+    if (serverFd != -1) stopServer();
+    else if (viewerPid != -1) stop(viewerPid);
+    viewerPid = -1;
+    reap();
+}
@@ -0,0 +1,16 @@
+#ifndef __VIEWER_H__
+#define __VIEWER_H__
+
+// start showing images with the given viewer command
+// if the environment variable IMG_VIEWER_SERVER is set, it is run once (by
+// /bin/sh) and sent one path per line on its stdin for every image; otherwise
+// (or if that process goes away) a new viewer process is spawned per image
+void viewerInit(const char* viewer);
+
+// show an image, replacing whatever the viewer was showing before
+void viewerShow(const char* filename);
+
+// shut down the viewer
+void viewerQuit();
+
+#endif